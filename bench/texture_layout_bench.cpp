@@ -0,0 +1,92 @@
+// Bilinear sampling speed of the row-major and 4x4-tiled texture layouts.
+// A 1024x1024 block of pixels walks a 2048x2048 rgba8 texture at several angles and texel steps.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "rasterizer/types.hpp"
+
+using namespace rasterizer;
+
+static constexpr int TEXTURE_SIZE = 2048;
+static constexpr int BLOCK_SIZE = 1024;
+static constexpr int RUNS = 5;
+
+struct walk
+{
+    const char *name;
+    float degrees;
+};
+
+static texture make_texture()
+{
+    std::vector<std::uint8_t> texels(static_cast<std::size_t>(TEXTURE_SIZE) * TEXTURE_SIZE * 4);
+    std::uint32_t state = 1;
+    for (std::uint8_t &texel : texels)
+    {
+        state = state * 1664525u + 1013904223u;
+        texel = static_cast<std::uint8_t>(state >> 24);
+    }
+
+    return texture(TEXTURE_SIZE, TEXTURE_SIZE, texture_format::rgba8, std::move(texels));
+}
+
+// Best of RUNS, in ms. Neighbouring pixels are step texels apart along the walk direction.
+static double time_walk(const texture &tex, float degrees, float step, float &sink)
+{
+    const float angle = math::to_radians(degrees);
+    const float scale = step / static_cast<float>(TEXTURE_SIZE - 1);
+    const float du_dx = math::cos(angle) * scale, dv_dx = math::sin(angle) * scale;
+    const float du_dy = -dv_dx, dv_dy = du_dx;
+
+    double best = 1e30;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        vector3f sum{0.0f, 0.0f, 0.0f};
+        for (int y = 0; y < BLOCK_SIZE; ++y)
+        {
+            float u = du_dy * static_cast<float>(y) + 0.25f;
+            float v = dv_dy * static_cast<float>(y) + 0.25f;
+            for (int x = 0; x < BLOCK_SIZE; ++x, u += du_dx, v += dv_dx)
+                sum += tex.sample_texture_bilinear(u, v);
+        }
+
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        best = ms < best ? ms : best;
+        sink += sum.x + sum.y + sum.z;
+    }
+
+    return best;
+}
+
+int main()
+{
+    texture row_major = make_texture();
+    texture tiled = make_texture();
+    tiled.set_layout(texture_layout::tiled);
+
+    const walk walks[] = {{"horizontal", 0.0f}, {"vertical", 90.0f}, {"rot45", 45.0f}, {"rot80", 80.0f}};
+
+    std::printf("%dx%d rgba8, %dx%d bilinear samples, best of %d, ms as row-major / tiled\n",
+                TEXTURE_SIZE, TEXTURE_SIZE, BLOCK_SIZE, BLOCK_SIZE, RUNS);
+
+    float sink = 0.0f;
+    for (float step : {1.0f, 3.0f})
+    {
+        std::printf("step %.0f:", step);
+        for (const walk &w : walks)
+        {
+            const double row_major_ms = time_walk(row_major, w.degrees, step, sink);
+            const double tiled_ms = time_walk(tiled, w.degrees, step, sink);
+            std::printf(" %s %.1f/%.1f", w.name, row_major_ms, tiled_ms);
+        }
+        std::printf("\n");
+    }
+
+    // Keeps the samples from being optimized away
+    std::printf("checksum %g\n", sink);
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Vertices per second through each way of getting a model-space position to screen pixels.
+// 1M random positions in front of the camera, single thread, best of 7 runs.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "rasterizer/model.hpp"
+#include "rasterizer/vertex_kernel.hpp"
+
+using namespace rasterizer;
+
+static constexpr std::uint32_t VERTEX_COUNT = 1 << 20;
+static constexpr int RUNS = 7;
+
+// The per-vertex path from before the matrices were cached, basis vectors rebuilt for every vertex
+static vector3f basis_to_view(const vector3f &p, const transform &model_transform, const transform &view)
+{
+    auto [ihat, jhat, khat] = model_transform.get_basis_vector();
+    const vector3f world = model_transform.transform_vector(ihat * model_transform.scale.x, jhat * model_transform.scale.y,
+                                                            khat * model_transform.scale.z, p) +
+                           model_transform.position;
+
+    auto [ihat_inverse, jhat_inverse, khat_inverse] = view.get_inverse_basis_vector();
+    const vector3f local = view.transform_vector(ihat_inverse, jhat_inverse, khat_inverse, world - view.position);
+    return {local.x / view.scale.x, local.y / view.scale.y, local.z / view.scale.z};
+}
+
+template <typename F>
+static void report(const char *name, F &&fn)
+{
+    double best = 1e30;
+    for (int run = 0; run < RUNS; ++run)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::printf("%-42s %8.1f M vertices/s\n", name, VERTEX_COUNT / best * 1e-6);
+}
+
+int main()
+{
+    Random rng(7);
+    std::vector<vector3f> positions(VERTEX_COUNT);
+    for (vector3f &p : positions)
+        p = rng.next_vector3f(-5.0f, 5.0f);
+    const position_stream stream = make_position_stream(positions);
+
+    transform model_transform;
+    model_transform.position = {0.0f, 0.0f, 20.0f};
+    model_transform.yaw = 0.3f;
+    model_transform.pitch = 0.1f;
+    model_transform.scale = {1.5f, 1.5f, 1.5f};
+
+    camera cam;
+    cam.camera_transform.yaw = 0.05f;
+    cam.update_camera_vectors();
+    vector2f screen{1920.0f, 1080.0f};
+    const clip_volume volume{screen.x, screen.y, cam.near_clip, cam.far_clip};
+
+    std::vector<vector2f> screen_positions(VERTEX_COUNT);
+    std::vector<transformed_vertex> transformed(VERTEX_COUNT);
+    std::vector<std::uint8_t> outcodes(VERTEX_COUNT);
+
+    report("basis vectors per vertex", [&]
+           {
+        for (std::uint32_t i = 0; i < VERTEX_COUNT; ++i)
+        {
+            const vector3f view = basis_to_view(positions[i], model_transform, cam.camera_transform);
+            if (view.z > cam.near_clip)
+                screen_positions[i] = view_to_screen(view, screen, cam);
+        } });
+
+    report("vertex_to_view + view_to_screen", [&]
+           {
+        for (std::uint32_t i = 0; i < VERTEX_COUNT; ++i)
+        {
+            const vector3f view = vertex_to_view(positions[i], model_transform, cam);
+            if (view.z > cam.near_clip)
+                screen_positions[i] = view_to_screen(view, screen, cam);
+        } });
+
+    const matrix4f model_view_projection = cam.get_view_projection(screen) * model_transform.get_matrix();
+
+    report("scalar transform_point + divide", [&]
+           {
+        for (std::uint32_t i = 0; i < VERTEX_COUNT; ++i)
+        {
+            const vector4f clip = transform_point(model_view_projection, positions[i]);
+            const float inv_w = 1.0f / clip.w;
+            transformed[i] = {{clip.x * inv_w, clip.y * inv_w}, inv_w, clip.w};
+            outcodes[i] = compute_outcode(clip, volume);
+        } });
+
+    report("transform_vertices kernel", [&]
+           { transform_vertices(stream, 0, VERTEX_COUNT, model_view_projection, volume, transformed.data(), outcodes.data()); });
+
+    // The kernel against the per-vertex reference path
+    double max_error = 0.0;
+    for (std::uint32_t i = 0; i < VERTEX_COUNT; ++i)
+    {
+        const vector3f view = vertex_to_view(positions[i], model_transform, cam);
+        if (view.z <= cam.near_clip)
+            continue;
+
+        const vector2f reference = view_to_screen(view, screen, cam);
+        max_error = std::max(max_error, static_cast<double>(std::max(std::fabs(reference.x - transformed[i].screen.x),
+                                                                     std::fabs(reference.y - transformed[i].screen.y))));
+    }
+    std::printf("kernel max screen error vs vertex_to_view + view_to_screen: %.2e px\n", max_error);
+    return 0;
+}
@@ -81,6 +81,7 @@ namespace application
 
     void application::post_render()
     {
+        m_rasterizer_engine->post_renders();
 
         SDL_Rect rect{.x = 0, .y = 0, .w = m_width, .h = m_height};
         SDL_BlitSurface(m_draw_surface, nullptr, SDL_GetWindowSurface(m_window), &rect);
@@ -103,6 +104,7 @@ namespace application
             last_fps_time = current_time;
 
             std::cout << "FPS: " << fps << std::endl;
+            std::cout << m_rasterizer_engine->get_frame_stats() << std::endl;
 
             frame_count = 0;
         }
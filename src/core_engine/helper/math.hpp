@@ -1,5 +1,8 @@
 #pragma once
 
+#include <bit>
+#include <cstdint>
+
 namespace math
 {
     //
@@ -163,6 +166,18 @@ namespace math
         return 2.0f * (y + y2 * y / 3.0f + y2 * y2 * y / 5.0f);
     }
 
+    // Exponent bits plus a quadratic fit of the mantissa, accurate to about 0.005. Good enough to pick mip levels.
+    inline float log2(float x)
+    {
+        if (x <= 0.0f)
+            return -126.0f;
+
+        const std::uint32_t bits = std::bit_cast<std::uint32_t>(x);
+        const float exponent = static_cast<float>(static_cast<int>((bits >> 23) & 0xFF) - 127);
+        const float mantissa = std::bit_cast<float>((bits & 0x007FFFFFu) | 0x3F800000u);
+        return exponent + (-0.34484843f * mantissa + 2.02466578f) * mantissa - 1.67487759f;
+    }
+
     template <typename T>
     constexpr T pow(const T &base, int exp)
     {
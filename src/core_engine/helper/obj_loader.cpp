@@ -1,3 +1,4 @@
+#include <cstring>
 #include <sstream>
 #include <fstream>
 
@@ -138,7 +139,10 @@ namespace helper
         return bytes;
     }
 
-    rasterizer::texture create_texture_from_bytes(const std::vector<std::uint8_t> &bytes)
+    rasterizer::texture create_texture_from_bytes(const std::vector<std::uint8_t> &bytes,
+                                                  rasterizer::texture_format format,
+                                                  bool generate_mipmaps,
+                                                  rasterizer::texture_layout layout)
     {
         if (bytes.size() < 4)
             throw std::runtime_error("Invalid texture bytes");
@@ -153,22 +157,24 @@ namespace helper
         if (bytes.size() < expected_size)
             throw std::runtime_error("Invalid texture bytes");
 
-        std::vector<rasterizer::vector3f> image_data(width * height);
+        const std::size_t texel_size = static_cast<std::size_t>(format);
+        std::vector<std::uint8_t> texels(static_cast<std::size_t>(width) * height * texel_size);
         std::size_t byte_index = 4;
 
-        for (int y = 0; y < height; ++y)
+        for (std::size_t i = 0; i < texels.size(); i += texel_size)
         {
-            for (int x = 0; x < width; ++x)
-            {
-                float b = bytes[byte_index + 0] / 255.0f;
-                float g = bytes[byte_index + 1] / 255.0f;
-                float r = bytes[byte_index + 2] / 255.0f;
-
-                image_data[y * width + x] = rasterizer::vector3f{r, g, b};
-                byte_index += 3;
-            }
+            // Source is BGR, packed texels are RGBA
+            const std::uint8_t rgba[4] = {bytes[byte_index + 2], bytes[byte_index + 1], bytes[byte_index + 0], 0xFF};
+            std::memcpy(&texels[i], rgba, texel_size);
+            byte_index += 3;
         }
 
-        return rasterizer::texture(width, height, std::move(image_data));
+        rasterizer::texture texture(width, height, format, std::move(texels));
+        if (generate_mipmaps)
+            texture.generate_mipmaps();
+
+        texture.set_layout(layout);
+
+        return texture;
     }
 }
@@ -31,5 +31,10 @@ namespace helper
 
     std::vector<std::uint8_t> load_bytes_texture(const std::string &filename);
 
-    rasterizer::texture create_texture_from_bytes(const std::vector<std::uint8_t> &bytes);
+    // Converts the BGR .bytes layout into a packed texture, keeping the first channels format holds.
+    // The mip chain is built here so shaders can sample with sample_texture_grad.
+    rasterizer::texture create_texture_from_bytes(const std::vector<std::uint8_t> &bytes,
+                                                  rasterizer::texture_format format = rasterizer::texture_format::rgba8,
+                                                  bool generate_mipmaps = true,
+                                                  rasterizer::texture_layout layout = rasterizer::texture_layout::row_major);
 }
\ No newline at end of file
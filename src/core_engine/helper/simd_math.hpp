@@ -1,56 +1,202 @@
 #pragma once
 
-#include <xmmintrin.h>
+#include <cstdint>
 
-#include "rasterizer/types.hpp"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
 
-namespace helper
+namespace simd
 {
-    inline __m128 calculate_barycentric_areas_simd(
-        const rasterizer::vector2f &a,
-        const rasterizer::vector2f &b,
-        const rasterizer::vector2f &c,
-        const rasterizer::vector2f &p)
-    {
-
-        // --- Data Setup ---
-        // The _mm_set_ps intrinsic loads four floats into a 128-bit SIMD register.
-        // The argument order is reversed (w, z, y, x). We are setting up "lanes"
-        // to calculate the three areas (pbc, apc, abp) at the same time.
-
-        // Load the X coordinates of the first vertex for each area calculation.
-        // Lane 0: p.x (for pbc), Lane 1: a.x (for apc), Lane 2: a.x (for abp)
-        __m128 p1_x = _mm_set_ps(0.0f, a.x, a.x, p.x);
-        // Load the Y coordinates of the first vertex for each area calculation.
-        __m128 p1_y = _mm_set_ps(0.0f, a.y, a.y, p.y);
-
-        // Load the X coords for the second vertex of each area.
-        // Lane 0: b.x, Lane 1: p.x, Lane 2: b.x
-        __m128 p2_x = _mm_set_ps(0.0f, b.x, p.x, b.x);
-        // Load the Y coords for the second vertex of each area.
-        __m128 p2_y = _mm_set_ps(0.0f, b.y, p.y, b.y);
-
-        // Load the X coords for the third vertex of each area.
-        // Lane 0: c.x, Lane 1: c.x, Lane 2: p.x
-        __m128 p3_x = _mm_set_ps(0.0f, p.x, c.x, c.x);
-        // Load the Y coords for the third vertex of each area.
-        __m128 p3_y = _mm_set_ps(0.0f, p.y, c.y, c.y);
-
-        // --- SIMD Calculation ---
-        // Perform subtractions on all four lanes at once to get the edge vectors.
-        // This calculates vectors like (c - p), (c - a), and (p - a) all at the same time.
-        __m128 v21_x = _mm_sub_ps(p3_x, p1_x); // Vector from p1 to p3 (x components)
-        __m128 v21_y = _mm_sub_ps(p3_y, p1_y); // Vector from p1 to p3 (y components)
-        __m128 v10_x = _mm_sub_ps(p2_x, p1_x); // Vector from p1 to p2 (x components)
-        __m128 v10_y = _mm_sub_ps(p2_y, p1_y); // Vector from p1 to p2 (y components)
-
-        // Perform multiplications on all four lanes at once.
-        __m128 term1 = _mm_mul_ps(v21_x, v10_y);
-        __m128 term2 = _mm_mul_ps(v21_y, v10_x);
-
-        // Perform the final subtraction to get the 2D cross-product (which is 2 * area).
-        // This single instruction finalizes the calculation for all three areas.
-        return _mm_sub_ps(term1, term2);
-    }
-
-}
\ No newline at end of file
+    //
+    // Thin wrappers so the raster kernels are written once for SSE2 (4 lanes) and AVX2 (8 lanes)
+    //
+
+#if defined(__AVX2__)
+    constexpr int WIDTH = 8;
+
+    using float_v = __m256;
+
+    inline float_v set1(float x) { return _mm256_set1_ps(x); }
+
+    inline float_v lane_offsets() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+
+    inline float_v load(const float *ptr) { return _mm256_loadu_ps(ptr); }
+
+    inline void store(float *ptr, float_v v) { _mm256_storeu_ps(ptr, v); }
+
+    inline float_v add(float_v a, float_v b) { return _mm256_add_ps(a, b); }
+
+    inline float_v sub(float_v a, float_v b) { return _mm256_sub_ps(a, b); }
+
+    inline float_v mul(float_v a, float_v b) { return _mm256_mul_ps(a, b); }
+
+    inline float_v div(float_v a, float_v b) { return _mm256_div_ps(a, b); }
+
+    inline float_v max(float_v a, float_v b) { return _mm256_max_ps(a, b); }
+
+    inline float reduce_max(float_v v)
+    {
+        __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+
+    inline float_v cmp_ge(float_v a, float_v b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+
+    inline float_v cmp_lt(float_v a, float_v b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+
+    inline float_v cmp_le(float_v a, float_v b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+
+    inline float_v bit_and(float_v a, float_v b) { return _mm256_and_ps(a, b); }
+
+    inline float_v bit_or(float_v a, float_v b) { return _mm256_or_ps(a, b); }
+
+    // Lanes of mask pick a, the others pick b
+    inline float_v select(float_v mask, float_v a, float_v b) { return _mm256_blendv_ps(b, a, mask); }
+
+    inline int move_mask(float_v mask) { return _mm256_movemask_ps(mask); }
+
+    // Writes WIDTH records of four floats, record i holds lane i of a, b, c and d
+    inline void store_interleaved4(float *ptr, float_v a, float_v b, float_v c, float_v d)
+    {
+        // Each 128-bit half is transposed on its own, records 0..3 come from the low halves
+        const __m256 ab_lo = _mm256_unpacklo_ps(a, b);
+        const __m256 ab_hi = _mm256_unpackhi_ps(a, b);
+        const __m256 cd_lo = _mm256_unpacklo_ps(c, d);
+        const __m256 cd_hi = _mm256_unpackhi_ps(c, d);
+        const __m256 r0 = _mm256_shuffle_ps(ab_lo, cd_lo, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 r1 = _mm256_shuffle_ps(ab_lo, cd_lo, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 r2 = _mm256_shuffle_ps(ab_hi, cd_hi, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 r3 = _mm256_shuffle_ps(ab_hi, cd_hi, _MM_SHUFFLE(3, 2, 3, 2));
+        _mm256_storeu_ps(ptr, _mm256_permute2f128_ps(r0, r1, 0x20));
+        _mm256_storeu_ps(ptr + 8, _mm256_permute2f128_ps(r2, r3, 0x20));
+        _mm256_storeu_ps(ptr + 16, _mm256_permute2f128_ps(r0, r1, 0x31));
+        _mm256_storeu_ps(ptr + 24, _mm256_permute2f128_ps(r2, r3, 0x31));
+    }
+
+    // Float lane mask with lane i set when bit i of bits is
+    inline float_v mask_from_bits(int bits)
+    {
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane_bits), lane_bits));
+    }
+
+    // 64-bit integer lanes for the fixed-point edge functions, WIDTH lanes split over two registers
+    struct int64_v
+    {
+        __m256i lo, hi;
+    };
+
+    inline int64_v set1_i64(std::int64_t x) { return int64_v{_mm256_set1_epi64x(x), _mm256_set1_epi64x(x)}; }
+
+    // step * i in lane i
+    inline int64_v lane_multiples_i64(std::int64_t step)
+    {
+        const __m256i lo = _mm256_setr_epi64x(0, step, step * 2, step * 3);
+        return int64_v{lo, _mm256_add_epi64(lo, _mm256_set1_epi64x(step * 4))};
+    }
+
+    inline int64_v add(int64_v a, int64_v b) { return int64_v{_mm256_add_epi64(a.lo, b.lo), _mm256_add_epi64(a.hi, b.hi)}; }
+
+    // Bit i set when lane i is negative, the sign bit is where a double keeps it
+    inline int sign_mask(int64_v v)
+    {
+        return _mm256_movemask_pd(_mm256_castsi256_pd(v.lo)) | (_mm256_movemask_pd(_mm256_castsi256_pd(v.hi)) << 4);
+    }
+#else
+    constexpr int WIDTH = 4;
+
+    using float_v = __m128;
+
+    inline float_v set1(float x) { return _mm_set1_ps(x); }
+
+    inline float_v lane_offsets() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+
+    inline float_v load(const float *ptr) { return _mm_loadu_ps(ptr); }
+
+    inline void store(float *ptr, float_v v) { _mm_storeu_ps(ptr, v); }
+
+    inline float_v add(float_v a, float_v b) { return _mm_add_ps(a, b); }
+
+    inline float_v sub(float_v a, float_v b) { return _mm_sub_ps(a, b); }
+
+    inline float_v mul(float_v a, float_v b) { return _mm_mul_ps(a, b); }
+
+    inline float_v div(float_v a, float_v b) { return _mm_div_ps(a, b); }
+
+    inline float_v max(float_v a, float_v b) { return _mm_max_ps(a, b); }
+
+    inline float reduce_max(float_v v)
+    {
+        __m128 m = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        return _mm_cvtss_f32(m);
+    }
+
+    inline float_v cmp_ge(float_v a, float_v b) { return _mm_cmpge_ps(a, b); }
+
+    inline float_v cmp_lt(float_v a, float_v b) { return _mm_cmplt_ps(a, b); }
+
+    inline float_v cmp_le(float_v a, float_v b) { return _mm_cmple_ps(a, b); }
+
+    inline float_v bit_and(float_v a, float_v b) { return _mm_and_ps(a, b); }
+
+    inline float_v bit_or(float_v a, float_v b) { return _mm_or_ps(a, b); }
+
+    // Lanes of mask pick a, the others pick b
+    inline float_v select(float_v mask, float_v a, float_v b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+    inline int move_mask(float_v mask) { return _mm_movemask_ps(mask); }
+
+    // Writes WIDTH records of four floats, record i holds lane i of a, b, c and d
+    inline void store_interleaved4(float *ptr, float_v a, float_v b, float_v c, float_v d)
+    {
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(ptr, a);
+        _mm_storeu_ps(ptr + 4, b);
+        _mm_storeu_ps(ptr + 8, c);
+        _mm_storeu_ps(ptr + 12, d);
+    }
+
+    // Float lane mask with lane i set when bit i of bits is
+    inline float_v mask_from_bits(int bits)
+    {
+        const __m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lane_bits), lane_bits));
+    }
+
+    // 64-bit integer lanes for the fixed-point edge functions, WIDTH lanes split over two registers
+    struct int64_v
+    {
+        __m128i lo, hi;
+    };
+
+    inline int64_v set1_i64(std::int64_t x) { return int64_v{_mm_set1_epi64x(x), _mm_set1_epi64x(x)}; }
+
+    // step * i in lane i
+    inline int64_v lane_multiples_i64(std::int64_t step)
+    {
+        const __m128i lo = _mm_set_epi64x(step, 0);
+        return int64_v{lo, _mm_add_epi64(lo, _mm_set1_epi64x(step * 2))};
+    }
+
+    inline int64_v add(int64_v a, int64_v b) { return int64_v{_mm_add_epi64(a.lo, b.lo), _mm_add_epi64(a.hi, b.hi)}; }
+
+    // Bit i set when lane i is negative, the sign bit is where a double keeps it
+    inline int sign_mask(int64_v v)
+    {
+        return _mm_movemask_pd(_mm_castsi128_pd(v.lo)) | (_mm_movemask_pd(_mm_castsi128_pd(v.hi)) << 2);
+    }
+#endif
+
+    constexpr int FULL_MASK = (1 << WIDTH) - 1;
+
+    inline float_v lane_mask(int active_lanes)
+    {
+        return cmp_lt(lane_offsets(), set1(static_cast<float>(active_lanes)));
+    }
+}
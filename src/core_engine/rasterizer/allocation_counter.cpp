@@ -0,0 +1,72 @@
+#include "rasterizer/allocation_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace rasterizer
+{
+    static std::atomic<std::uint64_t> s_heap_allocations = 0;
+
+    std::uint64_t heap_allocation_count()
+    {
+        return s_heap_allocations.load(std::memory_order_relaxed);
+    }
+}
+
+// Replaces the global allocation functions, plain and aligned. The array and nothrow forms forward
+// to these by default.
+void *operator new(std::size_t size)
+{
+    rasterizer::s_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    rasterizer::s_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    const std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    if (void *ptr = _aligned_malloc(size ? size : 1, align))
+        return ptr;
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    if (void *ptr = std::aligned_alloc(align, ((size ? size : 1) + align - 1) / align * align))
+        return ptr;
+#endif
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(ptr, alignment);
+}
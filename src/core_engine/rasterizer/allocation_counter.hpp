@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rasterizer
+{
+    // Number of global operator new calls since the program started, from any thread.
+    // The engine keeps per-frame buffers alive between frames, so a steady-state frame should add none.
+    std::uint64_t heap_allocation_count();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+namespace rasterizer
+{
+    // Counters gathered while rendering one frame
+    struct frame_stats
+    {
+        // Geometry culling, models and meshlets by frustum and normal cone, triangles by face culling in setup
+        std::uint64_t models_culled = 0;
+        std::uint64_t meshlets_culled = 0;
+        std::uint64_t triangles_culled = 0;
+
+        // Triangles fully outside the view volume, and ones crossing near, far or the guard band
+        std::uint64_t triangles_rejected = 0;
+        std::uint64_t triangles_clipped = 0;
+
+        // Hierarchical traversal, RASTER_BLOCK_SIZE blocks per path
+        std::uint64_t blocks_rejected = 0;
+        std::uint64_t blocks_accepted = 0;
+        std::uint64_t blocks_partial = 0;
+
+        // Hi-z rejections
+        std::uint64_t triangles_occluded = 0;
+        std::uint64_t blocks_occluded = 0;
+
+        // Heap allocations from pre_renders to post_renders, on any thread
+        std::uint64_t heap_allocations = 0;
+
+        void reset() { *this = frame_stats{}; }
+
+        frame_stats &operator+=(const frame_stats &other)
+        {
+            models_culled += other.models_culled;
+            meshlets_culled += other.meshlets_culled;
+            triangles_culled += other.triangles_culled;
+            triangles_rejected += other.triangles_rejected;
+            triangles_clipped += other.triangles_clipped;
+            blocks_rejected += other.blocks_rejected;
+            blocks_accepted += other.blocks_accepted;
+            blocks_partial += other.blocks_partial;
+            triangles_occluded += other.triangles_occluded;
+            blocks_occluded += other.blocks_occluded;
+            heap_allocations += other.heap_allocations;
+            return *this;
+        }
+    };
+
+    // Stats of one tile on cache lines of their own. Neighbouring tiles run on different workers at the same time
+    // and bump their block counters per 8x8 block, packed stats would share lines between them.
+    struct alignas(64) padded_frame_stats
+    {
+        frame_stats stats;
+    };
+
+    inline std::ostream &operator<<(std::ostream &os, const frame_stats &stats)
+    {
+        os << "Models culled: " << stats.models_culled
+           << ", meshlets culled: " << stats.meshlets_culled
+           << ", triangles culled: " << stats.triangles_culled
+           << ", rejected: " << stats.triangles_rejected
+           << ", clipped: " << stats.triangles_clipped
+           << " | Blocks rejected: " << stats.blocks_rejected
+           << ", full: " << stats.blocks_accepted
+           << ", partial: " << stats.blocks_partial
+           << ", occluded: " << stats.blocks_occluded
+           << " | Triangles occluded: " << stats.triangles_occluded
+           << " | Heap allocations: " << stats.heap_allocations;
+        return os;
+    }
+}
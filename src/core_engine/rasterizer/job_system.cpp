@@ -0,0 +1,116 @@
+#include "rasterizer/job_system.hpp"
+
+namespace rasterizer
+{
+    job_system::job_system(unsigned int thread_count)
+    {
+        if (thread_count == 0)
+            thread_count = std::thread::hardware_concurrency();
+        if (thread_count == 0)
+            thread_count = 4;
+
+        m_workers.reserve(thread_count);
+        for (unsigned int t = 0; t < thread_count; ++t)
+            m_workers.emplace_back([this]()
+                                   { worker_loop(); });
+    }
+
+    job_system::~job_system()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_job_available.notify_all();
+
+        for (auto &worker : m_workers)
+        {
+            if (worker.joinable())
+                worker.join();
+        }
+    }
+
+    void job_system::submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.emplace_back(std::move(job));
+            ++m_pending;
+        }
+        m_job_available.notify_one();
+    }
+
+    void job_system::wait()
+    {
+        std::function<void()> job;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_pending > 0)
+        {
+            if (pop_job(job))
+            {
+                lock.unlock();
+                job();
+                job = nullptr;
+                lock.lock();
+                finish_job();
+                continue;
+            }
+
+            m_all_done.wait(lock, [this]()
+                            { return m_pending == 0; });
+        }
+    }
+
+    //
+    // Private Methods
+    //
+
+    void job_system::worker_loop()
+    {
+        std::function<void()> job;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_job_available.wait(lock, [this]()
+                                 { return m_stop || m_next_job < m_jobs.size(); });
+
+            if (m_stop)
+                return;
+
+            if (!pop_job(job))
+                continue;
+
+            lock.unlock();
+            job();
+            job = nullptr;
+            lock.lock();
+            finish_job();
+        }
+    }
+
+    // Expects m_mutex to be held
+    bool job_system::pop_job(std::function<void()> &out_job)
+    {
+        if (m_next_job >= m_jobs.size())
+            return false;
+
+        out_job = std::move(m_jobs[m_next_job++]);
+
+        if (m_next_job == m_jobs.size())
+        {
+            m_jobs.clear();
+            m_next_job = 0;
+        }
+
+        return true;
+    }
+
+    // Expects m_mutex to be held
+    void job_system::finish_job()
+    {
+        if (--m_pending == 0)
+            m_all_done.notify_all();
+    }
+}
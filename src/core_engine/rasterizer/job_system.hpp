@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "helper/math.hpp"
+
+namespace rasterizer
+{
+    // Long-lived worker pool shared by every engine stage.
+    // Workers stay parked on a condition variable between frames, so the number of
+    // draw calls no longer scales the number of threads created.
+    class job_system
+    {
+    public:
+        // thread_count == 0 picks std::thread::hardware_concurrency()
+        explicit job_system(unsigned int thread_count = 0);
+        ~job_system();
+
+        job_system(const job_system &) = delete;
+        job_system &operator=(const job_system &) = delete;
+
+        unsigned int thread_count() const { return static_cast<unsigned int>(m_workers.size()); }
+
+        // Queue a job, it may start running immediately on a parked worker
+        void submit(std::function<void()> job);
+
+        // Block until every submitted job has finished, the caller helps draining the queue.
+        // Must not be called from inside a job.
+        void wait();
+
+        // Run fn(index) for index in [0, count) across all workers and the calling thread, then wait
+        template <typename F>
+        void parallel_for(int count, F &&fn)
+        {
+            if (count <= 0)
+                return;
+
+            if (count == 1 || m_workers.empty())
+            {
+                for (int i = 0; i < count; ++i)
+                    fn(i);
+                return;
+            }
+
+            std::atomic<int> next_index = 0;
+            auto run = [&]()
+            {
+                for (int i = next_index.fetch_add(1); i < count; i = next_index.fetch_add(1))
+                    fn(i);
+            };
+
+            // Each job only captures a pointer so std::function never allocates
+            auto *run_ptr = &run;
+            int job_count = math::min(count, static_cast<int>(m_workers.size()));
+            for (int j = 0; j < job_count; ++j)
+                submit([run_ptr]()
+                       { (*run_ptr)(); });
+
+            wait();
+        }
+
+    private:
+        std::vector<std::thread> m_workers;
+
+        std::mutex m_mutex;
+        std::condition_variable m_job_available;
+        std::condition_variable m_all_done;
+
+        // Queue is a vector plus read cursor, it is cleared once drained so its capacity is reused every frame
+        std::vector<std::function<void()>> m_jobs;
+        std::size_t m_next_job = 0;
+        int m_pending = 0;
+        bool m_stop = false;
+
+        void worker_loop();
+
+        bool pop_job(std::function<void()> &out_job);
+
+        void finish_job();
+    };
+}
@@ -0,0 +1,230 @@
+#include "rasterizer/meshlet.hpp"
+
+#include <algorithm>
+
+namespace rasterizer
+{
+    // Cones wider than this, measured as the smallest cosine to the axis, would never cull anything
+    static constexpr float MIN_CONE_SPREAD = 0.1f;
+
+    static void compute_meshlet_bounds(const mesh_data &mesh, const unsigned int *indices, meshlet &out)
+    {
+        // Sphere around the box of the corners, radius reaches the farthest one
+        vector3f box_min = mesh.positions[indices[0]];
+        vector3f box_max = box_min;
+        for (std::uint32_t i = 1; i < out.index_count; ++i)
+        {
+            const vector3f &p = mesh.positions[indices[i]];
+            box_min = {math::min(box_min.x, p.x), math::min(box_min.y, p.y), math::min(box_min.z, p.z)};
+            box_max = {math::max(box_max.x, p.x), math::max(box_max.y, p.y), math::max(box_max.z, p.z)};
+        }
+
+        const vector3f center = (box_min + box_max) * 0.5f;
+        float radius_squared = 0.0f;
+        for (std::uint32_t i = 0; i < out.index_count; ++i)
+        {
+            vector3f offset = mesh.positions[indices[i]] - center;
+            radius_squared = math::max(radius_squared, dot(offset, offset));
+        }
+        out.sphere = {center, math::sqrt(radius_squared)};
+
+        // Cone axis is the average face normal, zero-area triangles are never drawn so they do not count
+        vector3f normal_sum{0.0f, 0.0f, 0.0f};
+        for (std::uint32_t i = 0; i < out.index_count; i += 3)
+        {
+            const vector3f &p0 = mesh.positions[indices[i]];
+            vector3f normal = cross(mesh.positions[indices[i + 1]] - p0, mesh.positions[indices[i + 2]] - p0);
+            float length_squared = dot(normal, normal);
+            if (length_squared > 0.0f)
+                normal_sum += normal / math::sqrt(length_squared);
+        }
+
+        if (dot(normal_sum, normal_sum) == 0.0f)
+            return;
+
+        const vector3f axis = normalized_vector(normal_sum);
+        float min_cosine = 1.0f;
+        float apex_distance = 0.0f;
+        for (std::uint32_t i = 0; i < out.index_count; i += 3)
+        {
+            const vector3f &p0 = mesh.positions[indices[i]];
+            vector3f normal = cross(mesh.positions[indices[i + 1]] - p0, mesh.positions[indices[i + 2]] - p0);
+            float length_squared = dot(normal, normal);
+            if (length_squared == 0.0f)
+                continue;
+
+            normal = normal / math::sqrt(length_squared);
+            float cosine = dot(normal, axis);
+            min_cosine = math::min(min_cosine, cosine);
+
+            // Distance back along the axis to get behind this triangle's plane
+            if (cosine > 0.0f)
+                apex_distance = math::max(apex_distance, dot(center - p0, normal) / cosine);
+        }
+
+        if (min_cosine <= MIN_CONE_SPREAD)
+            return;
+
+        // Behind every triangle plane, an eye sees all of them from the back when it looks at the apex
+        // within 90 degrees minus the normal spread of the axis, so the cutoff is sin(spread)
+        out.cone_apex = center - axis * apex_distance;
+        out.cone_axis = axis;
+        out.cone_cutoff = math::sqrt(1.0f - min_cosine * min_cosine);
+    }
+
+    std::vector<meshlet> build_meshlets(const mesh_data &mesh, std::vector<unsigned int> &indices)
+    {
+        const std::uint32_t triangle_count = static_cast<std::uint32_t>(indices.size() / 3);
+        const std::size_t vertex_count = mesh.positions.size();
+
+        // Triangles using each vertex, flattened with per-vertex offsets
+        std::vector<std::uint32_t> vertex_offsets(vertex_count + 1, 0);
+        for (std::uint32_t i = 0; i < triangle_count * 3; ++i)
+            ++vertex_offsets[indices[i] + 1];
+        for (std::size_t v = 0; v < vertex_count; ++v)
+            vertex_offsets[v + 1] += vertex_offsets[v];
+
+        std::vector<std::uint32_t> vertex_triangles(triangle_count * 3);
+        std::vector<std::uint32_t> fill_cursor(vertex_offsets.begin(), vertex_offsets.end() - 1);
+        for (std::uint32_t i = 0; i < triangle_count * 3; ++i)
+            vertex_triangles[fill_cursor[indices[i]]++] = i / 3;
+
+        std::vector<std::uint8_t> assigned(triangle_count, 0);
+        std::vector<std::uint32_t> frontier;
+        std::vector<unsigned int> reordered;
+        reordered.reserve(triangle_count * 3);
+        std::vector<meshlet> meshlets;
+
+        std::uint32_t next_seed = 0;
+        std::uint32_t carried_seed = triangle_count;
+
+        while (true)
+        {
+            meshlet current;
+            current.first_index = static_cast<std::uint32_t>(reordered.size());
+
+            // Grow breadth first over shared vertices so the cluster stays compact,
+            // restarting from the next unassigned triangle when an island runs out
+            frontier.clear();
+            std::size_t head = 0;
+            std::uint32_t triangle_total = 0;
+
+            while (triangle_total < MESHLET_MAX_TRIANGLES)
+            {
+                std::uint32_t triangle;
+                if (head < frontier.size())
+                {
+                    triangle = frontier[head++];
+                    if (assigned[triangle])
+                        continue;
+                }
+                else if (triangle_total == 0 && carried_seed < triangle_count && !assigned[carried_seed])
+                {
+                    triangle = carried_seed;
+                }
+                else
+                {
+                    while (next_seed < triangle_count && assigned[next_seed])
+                        ++next_seed;
+                    if (next_seed == triangle_count)
+                        break;
+                    triangle = next_seed;
+                }
+
+                assigned[triangle] = 1;
+                ++triangle_total;
+                for (int k = 0; k < 3; ++k)
+                {
+                    const unsigned int index = indices[triangle * 3 + k];
+                    reordered.push_back(index);
+
+                    for (std::uint32_t a = vertex_offsets[index]; a < vertex_offsets[index + 1]; ++a)
+                    {
+                        if (!assigned[vertex_triangles[a]])
+                            frontier.push_back(vertex_triangles[a]);
+                    }
+                }
+            }
+
+            if (triangle_total == 0)
+                break;
+
+            // Continue next to this meshlet so neighbouring clusters stay close in memory too
+            carried_seed = triangle_count;
+            for (; head < frontier.size(); ++head)
+            {
+                if (!assigned[frontier[head]])
+                {
+                    carried_seed = frontier[head];
+                    break;
+                }
+            }
+
+            current.index_count = triangle_total * 3;
+            compute_meshlet_bounds(mesh, reordered.data() + current.first_index, current);
+            meshlets.push_back(current);
+        }
+
+        // A trailing partial triangle was never drawn and is dropped here
+        indices.swap(reordered);
+        return meshlets;
+    }
+
+    std::vector<std::uint32_t> reorder_meshlet_vertices(mesh_data &mesh, std::vector<unsigned int> &indices, std::vector<meshlet> &meshlets)
+    {
+        constexpr std::uint32_t UNUSED = ~std::uint32_t{0};
+        const std::size_t vertex_count = mesh.positions.size();
+
+        // New number of every old vertex and the meshlet that owns it
+        std::vector<std::uint32_t> remap(vertex_count, UNUSED);
+        std::vector<std::uint32_t> owner(vertex_count, UNUSED);
+        std::vector<std::uint32_t> lenders;
+        std::uint32_t next_vertex = 0;
+
+        for (std::uint32_t meshlet_index = 0; meshlet_index < meshlets.size(); ++meshlet_index)
+        {
+            meshlet &cluster = meshlets[meshlet_index];
+            cluster.first_vertex = next_vertex;
+            cluster.first_lender = static_cast<std::uint32_t>(lenders.size());
+
+            for (std::uint32_t i = cluster.first_index; i < cluster.first_index + cluster.index_count; ++i)
+            {
+                const unsigned int index = indices[i];
+                if (remap[index] == UNUSED)
+                {
+                    remap[index] = next_vertex++;
+                    owner[index] = meshlet_index;
+                }
+                else if (owner[index] != meshlet_index &&
+                         std::find(lenders.begin() + cluster.first_lender, lenders.end(), owner[index]) == lenders.end())
+                {
+                    lenders.push_back(owner[index]);
+                }
+                indices[i] = remap[index];
+            }
+
+            cluster.vertex_count = next_vertex - cluster.first_vertex;
+            cluster.lender_count = static_cast<std::uint32_t>(lenders.size()) - cluster.first_lender;
+        }
+
+        for (std::size_t v = 0; v < vertex_count; ++v)
+        {
+            if (remap[v] == UNUSED)
+                remap[v] = next_vertex++;
+        }
+
+        mesh_data reordered;
+        reordered.positions.resize(vertex_count);
+        reordered.tex_coords.resize(vertex_count);
+        reordered.normals.resize(vertex_count);
+        for (std::size_t v = 0; v < vertex_count; ++v)
+        {
+            reordered.positions[remap[v]] = mesh.positions[v];
+            reordered.tex_coords[remap[v]] = mesh.tex_coords[v];
+            reordered.normals[remap[v]] = mesh.normals[v];
+        }
+        mesh = std::move(reordered);
+
+        return lenders;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rasterizer/types.hpp"
+#include "rasterizer/types_math.hpp"
+
+namespace rasterizer
+{
+    // Upper bound on the triangles in one meshlet
+    constexpr std::uint32_t MESHLET_MAX_TRIANGLES = 128;
+
+    // Cluster of nearby triangles that are contiguous in the model index buffer.
+    // Culled as a whole before any of its vertices are transformed.
+    struct meshlet
+    {
+        std::uint32_t first_index = 0;
+        std::uint32_t index_count = 0;
+
+        // Vertices this meshlet uses first, contiguous once reorder_meshlet_vertices ran
+        std::uint32_t first_vertex = 0;
+        std::uint32_t vertex_count = 0;
+
+        // Earlier meshlets owning the rest of its vertices, a range of the list reorder_meshlet_vertices returns
+        std::uint32_t first_lender = 0;
+        std::uint32_t lender_count = 0;
+
+        // Model space
+        bounding_sphere sphere;
+
+        // Normal cone, every triangle faces away from eyes that see the apex within the cutoff around the axis.
+        // Front faces follow counter-clockwise winding, cross(p1 - p0, p2 - p0) points out of the surface.
+        vector3f cone_apex{0.0f, 0.0f, 0.0f};
+        vector3f cone_axis{0.0f, 0.0f, 1.0f};
+        float cone_cutoff = 2.0f; // Above any cosine, so the cone never culls
+
+        bool is_backfacing(const vector3f &eye) const
+        {
+            return dot(normalized_vector(cone_apex - eye), cone_axis) >= cone_cutoff;
+        }
+    };
+
+    // Splits the triangles into meshlets grown over shared vertices and reorders indices so each one is contiguous
+    std::vector<meshlet> build_meshlets(const mesh_data &mesh, std::vector<unsigned int> &indices);
+
+    // Renumbers the vertices in order of first use so each meshlet owns a contiguous range of them.
+    // Unused vertices move to the end. Returns the lender lists the meshlets point into.
+    std::vector<std::uint32_t> reorder_meshlet_vertices(mesh_data &mesh, std::vector<unsigned int> &indices, std::vector<meshlet> &meshlets);
+}
@@ -1,65 +1,456 @@
 #include "rasterizer/model.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <iostream>
 
 namespace rasterizer
 {
+    // Enough chunks to keep every worker busy when culling leaves them uneven, none too small to be worth a job
+    static int geometry_chunk_count(std::size_t triangle_count, const job_system &jobs)
+    {
+        const int max_chunks = static_cast<int>(jobs.thread_count() + 1) * 4;
+        const int wanted = static_cast<int>((triangle_count + MIN_TRIANGLES_PER_GEOMETRY_CHUNK - 1) / MIN_TRIANGLES_PER_GEOMETRY_CHUNK);
+        return math::clamp(wanted, 1, max_chunks);
+    }
+
     // Model Function
-    void model::fill_triangle_data()
+    std::uint32_t model::fill_triangle_data(job_system &jobs)
+    {
+        // Front faces come out of projection with a positive screen space area, since y points down
+        std::int64_t culled_orientation = 0;
+        if (face_culling != cull_mode::none)
+            culled_orientation = (face_culling == cull_mode::back) != m_transform.is_mirrored() ? -1 : 1;
+
+        // Same chunks process_model filled, each one sets up the triangles it projected
+        const int chunk_count = static_cast<int>(geometry_chunks.size());
+        jobs.parallel_for(chunk_count, [&](int chunk)
+                          { setup_triangles(geometry_chunks[chunk], culled_orientation); });
+
+        // Concatenate in chunk order, so the output is the same for any thread count
+        std::uint32_t triangles_culled = 0;
+        std::size_t triangle_total = 0;
+        for (geometry_chunk &out : geometry_chunks)
+        {
+            out.triangle_offset = triangle_total;
+            triangle_total += out.triangles.size();
+            triangles_culled += out.triangles_culled;
+        }
+
+        // A single chunk is swapped in instead of copied, its old buffers go back to the chunk
+        if (chunk_count == 1)
+        {
+            triangles_data.swap(geometry_chunks[0].triangles);
+            triangle_attributes_data.swap(geometry_chunks[0].attributes);
+            return triangles_culled;
+        }
+
+        // Not cleared first, so resize only initializes what grew since the last frame
+        triangles_data.resize(triangle_total);
+        triangle_attributes_data.resize(triangle_total);
+        jobs.parallel_for(chunk_count, [&](int chunk)
+                          {
+            const geometry_chunk &out = geometry_chunks[chunk];
+            std::copy(out.triangles.begin(), out.triangles.end(), triangles_data.begin() + out.triangle_offset);
+            std::copy(out.attributes.begin(), out.attributes.end(), triangle_attributes_data.begin() + out.triangle_offset); });
+
+        return triangles_culled;
+    }
+
+    void model::setup_triangles(geometry_chunk &out, std::int64_t culled_orientation) const
+    {
+        out.triangles.clear();
+        out.attributes.clear();
+        out.triangles_culled = 0;
+
+        const vertex_cache &cache = transformed_vertices;
+        const rasterizer_data_sao &clipped = out.clipped_vertices;
+        const unsigned int cached_count = static_cast<unsigned int>(m_mesh.positions.size());
+
+        // Everything was clipped to the guard band already, so every corner is in the fixed-point range
+        for (std::size_t i = 0; i < out.indices.size(); i += 3)
+        {
+            setup_vertex corners[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                unsigned int index = out.indices[i + k];
+                if (index < cached_count)
+                {
+                    const transformed_vertex &vertex = cache.vertices[index];
+                    corners[k] = setup_vertex{vertex.screen,
+                                              vertex.inv_depth,
+                                              m_mesh.tex_coords[index] * vertex.inv_depth,
+                                              m_mesh.normals[index] * vertex.inv_depth};
+                }
+                else
+                {
+                    index -= cached_count;
+                    float inv_depth = 1.0f / clipped.depth[index];
+                    corners[k] = setup_vertex{clipped.position[index],
+                                              inv_depth,
+                                              clipped.tex_coords[index] * inv_depth,
+                                              clipped.normals[index] * inv_depth};
+                }
+            }
+
+            rasterizer::triangle_data triangle;
+            rasterizer::triangle_attributes attributes;
+            setup_result result = setup_triangle(corners[0], corners[1], corners[2], triangle, attributes, culled_orientation);
+            if (result == setup_result::drawn)
+            {
+                out.triangles.emplace_back(triangle);
+                out.attributes.emplace_back(attributes);
+            }
+            out.triangles_culled += static_cast<std::uint32_t>(result == setup_result::culled);
+        }
+    }
+
+    void model::set_mesh(const mesh_data &mesh, const std::vector<unsigned int> &mesh_indices)
+    {
+        m_mesh = mesh;
+        indices = mesh_indices;
+
+        // Meshlets reorder the indices, the vertices follow in order of first use, the rest is built from those
+        meshlets = build_meshlets(m_mesh, indices);
+        meshlet_lenders = reorder_meshlet_vertices(m_mesh, indices, meshlets);
+        vertex_positions = make_position_stream(m_mesh.positions);
+        compute_local_bounds();
+
+        // The bounds changed without a move, the scene BVH refits them the same way
+        if (m_moved_models)
+            m_moved_models->push_back(m_scene_index);
+    }
+
+    void model::compute_local_bounds()
+    {
+        m_local_bounds = model_bounds{};
+        m_world_bounds_valid = false;
+
+        if (m_mesh.positions.empty())
+            return;
+
+        bounding_box &box = m_local_bounds.box;
+        box.min = m_mesh.positions[0];
+        box.max = m_mesh.positions[0];
+        for (const auto &v : m_mesh.positions)
+        {
+            box.min.x = math::min(box.min.x, v.x);
+            box.min.y = math::min(box.min.y, v.y);
+            box.min.z = math::min(box.min.z, v.z);
+            box.max.x = math::max(box.max.x, v.x);
+            box.max.y = math::max(box.max.y, v.y);
+            box.max.z = math::max(box.max.z, v.z);
+        }
+
+        // Centered on the box, radius reaches the farthest vertex
+        bounding_sphere &sphere = m_local_bounds.sphere;
+        sphere.center = (box.min + box.max) * 0.5f;
+        float radius_squared = 0.0f;
+        for (const auto &v : m_mesh.positions)
+        {
+            vector3f offset = v - sphere.center;
+            radius_squared = math::max(radius_squared, dot(offset, offset));
+        }
+        sphere.radius = math::sqrt(radius_squared);
+    }
+
+    bool model::update_world_bounds()
     {
-        triangles_data.clear();
+        if (m_world_bounds_valid && m_world_bounds_transform.same_placement(m_transform))
+            return false;
 
-        for (unsigned int i = 0; i < rasterizer_indices.size(); i += 3)
+        const bounding_box &local_box = m_local_bounds.box;
+
+        // Box around the eight transformed corners, stays conservative under rotation
+        for (int corner = 0; corner < 8; ++corner)
         {
-            unsigned int index0 = rasterizer_indices[i];
-            unsigned int index1 = rasterizer_indices[i + 1];
-            unsigned int index2 = rasterizer_indices[i + 2];
+            vector3f local{(corner & 1) ? local_box.max.x : local_box.min.x,
+                           (corner & 2) ? local_box.max.y : local_box.min.y,
+                           (corner & 4) ? local_box.max.z : local_box.min.z};
+            vector3f world = m_transform.to_world_position(local);
 
-            rasterizer::vector2f p0 = rasterizer_data.position[index0];
-            rasterizer::vector2f p1 = rasterizer_data.position[index1];
-            rasterizer::vector2f p2 = rasterizer_data.position[index2];
+            if (corner == 0)
+            {
+                m_world_bounds.box.min = world;
+                m_world_bounds.box.max = world;
+                continue;
+            }
 
-            // Triangle bounds
-            float minX = math::min(math::min(p0.x, p1.x), p2.x);
-            float minY = math::min(math::min(p0.y, p1.y), p2.y);
-            float maxX = math::max(math::max(p0.x, p1.x), p2.x);
-            float maxY = math::max(math::max(p0.y, p1.y), p2.y);
+            m_world_bounds.box.min.x = math::min(m_world_bounds.box.min.x, world.x);
+            m_world_bounds.box.min.y = math::min(m_world_bounds.box.min.y, world.y);
+            m_world_bounds.box.min.z = math::min(m_world_bounds.box.min.z, world.z);
+            m_world_bounds.box.max.x = math::max(m_world_bounds.box.max.x, world.x);
+            m_world_bounds.box.max.y = math::max(m_world_bounds.box.max.y, world.y);
+            m_world_bounds.box.max.z = math::max(m_world_bounds.box.max.z, world.z);
+        }
 
-            rasterizer::vector3f inv_depth{1.0f / rasterizer_data.depth[index0],
-                                           1.0f / rasterizer_data.depth[index1],
-                                           1.0f / rasterizer_data.depth[index2]};
+        const vector3f &scale = m_transform.scale;
+        float max_scale = math::max(math::abs(scale.x), math::max(math::abs(scale.y), math::abs(scale.z)));
+        m_world_bounds.sphere.center = m_transform.to_world_position(m_local_bounds.sphere.center);
+        m_world_bounds.sphere.radius = m_local_bounds.sphere.radius * max_scale;
 
-            rasterizer::vector2f tx{rasterizer_data.tex_coords[index0].x * inv_depth.x,
-                                    rasterizer_data.tex_coords[index0].y * inv_depth.x};
+        m_world_bounds_transform = m_transform;
+        m_world_bounds_valid = true;
+        return true;
+    }
 
-            rasterizer::vector2f ty{rasterizer_data.tex_coords[index1].x * inv_depth.y,
-                                    rasterizer_data.tex_coords[index1].y * inv_depth.y};
+    //
+    // Matrices
+    //
 
-            rasterizer::vector2f tz{rasterizer_data.tex_coords[index2].x * inv_depth.z,
-                                    rasterizer_data.tex_coords[index2].y * inv_depth.z};
+    static std::atomic<std::uint64_t> s_matrix_versions = 0;
 
-            rasterizer::vector3f nx{rasterizer_data.normals[index0].x * inv_depth.x,
-                                    rasterizer_data.normals[index0].y * inv_depth.x,
-                                    rasterizer_data.normals[index0].z * inv_depth.x};
+    void transform::update_matrices() const
+    {
+        if (m_matrix_version != 0 && yaw == m_matrix_yaw && pitch == m_matrix_pitch &&
+            position.x == m_matrix_position.x && position.y == m_matrix_position.y && position.z == m_matrix_position.z &&
+            scale.x == m_matrix_scale.x && scale.y == m_matrix_scale.y && scale.z == m_matrix_scale.z)
+            return;
+
+        // Basis vectors scaled are the columns, the inverse has them as rows divided by the scale instead
+        auto [ihat, jhat, khat] = get_basis_vector();
+        const vector3f columns[3] = {ihat * scale.x, jhat * scale.y, khat * scale.z};
+        const vector3f rows[3] = {ihat / scale.x, jhat / scale.y, khat / scale.z};
+
+        m_matrix = matrix4f{};
+        m_inverse_matrix = matrix4f{};
+        for (int i = 0; i < 3; ++i)
+        {
+            m_matrix.m[0][i] = columns[i].x;
+            m_matrix.m[1][i] = columns[i].y;
+            m_matrix.m[2][i] = columns[i].z;
+
+            m_inverse_matrix.m[i][0] = rows[i].x;
+            m_inverse_matrix.m[i][1] = rows[i].y;
+            m_inverse_matrix.m[i][2] = rows[i].z;
+            m_inverse_matrix.m[i][3] = -dot(rows[i], position);
+        }
+        m_matrix.m[0][3] = position.x;
+        m_matrix.m[1][3] = position.y;
+        m_matrix.m[2][3] = position.z;
+
+        m_matrix_yaw = yaw;
+        m_matrix_pitch = pitch;
+        m_matrix_position = position;
+        m_matrix_scale = scale;
+        m_matrix_version = s_matrix_versions.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
 
-            rasterizer::vector3f ny{rasterizer_data.normals[index1].x * inv_depth.y,
-                                    rasterizer_data.normals[index1].y * inv_depth.y,
-                                    rasterizer_data.normals[index1].z * inv_depth.y};
+    const matrix4f &camera::get_view_projection(const vector2f &screen)
+    {
+        const std::uint64_t view_version = camera_transform.get_matrix_version();
+        if (view_version == m_view_version && fov == m_projection_fov &&
+            screen.x == m_projection_screen.x && screen.y == m_projection_screen.y)
+            return m_view_projection;
+
+        m_view_projection = make_screen_projection(fov, screen) * camera_transform.get_inverse_matrix();
+        m_view_version = view_version;
+        m_projection_fov = fov;
+        m_projection_screen = screen;
+        return m_view_projection;
+    }
 
-            rasterizer::vector3f nz{rasterizer_data.normals[index2].x * inv_depth.z,
-                                    rasterizer_data.normals[index2].y * inv_depth.z,
-                                    rasterizer_data.normals[index2].z * inv_depth.z};
+    //
+    // Frustum Culling
+    //
 
-            float denom = (p1.y - p2.y) * (p0.x - p2.x) + (p2.x - p1.x) * (p0.y - p2.y);
-            if (std::abs(denom) < 1e-5f)
-                continue; // Skip degenerate triangles
-                          // ...existing code...
+    bool frustum::intersects(const bounding_sphere &sphere, std::uint32_t plane_mask) const
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            if ((plane_mask & (1u << i)) && planes[i].distance(sphere.center) < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
 
-            triangles_data.emplace_back(rasterizer::triangle_data{p0, p1, p2, minX, maxX, minY, maxY, index0, index1, index2, inv_depth, tx, ty, tz, nx, ny, nz});
+    bool frustum::intersects(const bounding_box &box, std::uint32_t &plane_mask) const
+    {
+        for (int i = 0; i < 6; ++i)
+        {
+            if (!(plane_mask & (1u << i)))
+                continue;
+
+            // Corners farthest along and against the normal, the box is outside when even the first one is
+            const frustum_plane &plane = planes[i];
+            vector3f farthest{plane.normal.x >= 0.0f ? box.max.x : box.min.x,
+                              plane.normal.y >= 0.0f ? box.max.y : box.min.y,
+                              plane.normal.z >= 0.0f ? box.max.z : box.min.z};
+            vector3f nearest{plane.normal.x >= 0.0f ? box.min.x : box.max.x,
+                             plane.normal.y >= 0.0f ? box.min.y : box.max.y,
+                             plane.normal.z >= 0.0f ? box.min.z : box.max.z};
+
+            if (plane.distance(farthest) < 0.0f)
+                return false;
+            if (plane.distance(nearest) >= 0.0f)
+                plane_mask &= ~(1u << i);
         }
+        return true;
     }
 
-    vector3f vertex_to_screen(const vector3f &vertex, transform &transform, const vector2f &screen, camera &cam)
+    static frustum_plane make_plane(const vector3f &normal, const vector3f &point)
+    {
+        vector3f unit = normalized_vector(normal);
+        return {unit, -dot(unit, point)};
+    }
+
+    frustum make_frustum(const camera &cam, float aspect_ratio)
+    {
+        // Same projection as view_to_screen, view space x / z spans +-scale_x
+        const float scale_y = math::tan(cam.fov / 2.0f);
+        const float scale_x = scale_y * aspect_ratio;
+
+        const vector3f &eye = cam.camera_transform.position;
+        const vector3f &forward = cam.cam_forward;
+        const vector3f &right = cam.cam_right;
+        const vector3f &up = cam.cam_up;
+
+        frustum result;
+        result.planes[0] = make_plane(forward, eye + forward * cam.near_clip);
+        result.planes[1] = make_plane(forward * -1.0f, eye + forward * cam.far_clip);
+        result.planes[2] = make_plane(right + forward * scale_x, eye);
+        result.planes[3] = make_plane(forward * scale_x - right, eye);
+        result.planes[4] = make_plane(up + forward * scale_y, eye);
+        result.planes[5] = make_plane(forward * scale_y - up, eye);
+        return result;
+    }
+
+    //
+    // Triangle Setup
+    //
+
+    // Edge from (x_from, y_from) to (x_to, y_to), oriented so the inside of the triangle is positive
+    static edge_equation make_edge(std::int64_t x_from, std::int64_t y_from, std::int64_t x_to, std::int64_t y_to, std::int64_t orientation)
+    {
+        edge_equation edge{static_cast<std::int32_t>((y_from - y_to) * orientation),
+                           static_cast<std::int32_t>((x_to - x_from) * orientation),
+                           0};
+        edge.c = -(edge.a * x_to + edge.b * y_to);
+
+        // Top-left rule, y points down. Left edges have the inside to their right (a > 0), top edges are
+        // horizontal with the inside below (a == 0, b > 0). Pixel centers exactly on any other edge are left out.
+        // Written without branches, since which side an edge falls on varies from edge to edge and
+        // a branch on it would mispredict often.
+        const std::int32_t inward = edge.a != 0 ? edge.a : edge.b;
+        edge.c += static_cast<std::int64_t>(inward > 0) - 1;
+
+        return edge;
+    }
+
+    setup_result setup_triangle(const setup_vertex &v0, const setup_vertex &v1, const setup_vertex &v2, triangle_data &out,
+                                triangle_attributes &out_attributes, std::int64_t culled_orientation)
+    {
+        const std::int64_t x0 = to_fixed(v0.position.x), y0 = to_fixed(v0.position.y);
+        const std::int64_t x1 = to_fixed(v1.position.x), y1 = to_fixed(v1.position.y);
+        const std::int64_t x2 = to_fixed(v2.position.x), y2 = to_fixed(v2.position.y);
+
+        // Twice the signed area in sub-pixels squared, exact, so only truly degenerate triangles are dropped
+        const std::int64_t area = (y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2);
+        if (area == 0)
+            return setup_result::degenerate;
+
+        const std::int64_t orientation = (area >> 63) | 1; // -1 or +1, without a branch
+        if (orientation == culled_orientation)
+            return setup_result::culled;
+        out.edge0 = make_edge(x1, y1, x2, y2, orientation);
+        out.edge1 = make_edge(x2, y2, x0, y0, orientation);
+        out.edge2 = make_edge(x0, y0, x1, y1, orientation);
+
+        // Everything else works on the snapped positions so it agrees with the coverage
+        constexpr float inv_scale = 1.0f / static_cast<float>(SUBPIXEL_SCALE);
+        const vector2f p0{static_cast<float>(x0) * inv_scale, static_cast<float>(y0) * inv_scale};
+        const vector2f p1{static_cast<float>(x1) * inv_scale, static_cast<float>(y1) * inv_scale};
+        const vector2f p2{static_cast<float>(x2) * inv_scale, static_cast<float>(y2) * inv_scale};
+
+        // Triangle bounds
+        out.minX = math::min(math::min(p0.x, p1.x), p2.x);
+        out.minY = math::min(math::min(p0.y, p1.y), p2.y);
+        out.maxX = math::max(math::max(p0.x, p1.x), p2.x);
+        out.maxY = math::max(math::max(p0.y, p1.y), p2.y);
+
+        out.inv_depth = vector3f{v0.inv_depth, v1.inv_depth, v2.inv_depth};
+
+        // Edge functions scaled by 1 / denom evaluate straight to the barycentric weights,
+        // which also makes them independent of the winding. Relative to the bounds corner like every plane.
+        const float inv_denom = static_cast<float>(SUBPIXEL_SCALE * SUBPIXEL_SCALE) / static_cast<float>(area);
+        const vector2f d0{p0.x - out.minX, p0.y - out.minY};
+        const vector2f d2{p2.x - out.minX, p2.y - out.minY};
+        plane_equation e0{(p1.y - p2.y) * inv_denom, (p2.x - p1.x) * inv_denom, 0.0f};
+        plane_equation e1{(p2.y - p0.y) * inv_denom, (p0.x - p2.x) * inv_denom, 0.0f};
+        plane_equation e2{(p0.y - p1.y) * inv_denom, (p1.x - p0.x) * inv_denom, 0.0f};
+        e0.c = -(e0.a * d2.x + e0.b * d2.y);
+        e1.c = -(e1.a * d2.x + e1.b * d2.y);
+        e2.c = -(e2.a * d0.x + e2.b * d0.y);
+
+        // Anything linear in screen space is the weighted sum of its corner values, folded into one plane
+        auto interpolation_plane = [&](float value0, float value1, float value2)
+        {
+            return plane_equation{value0 * e0.a + value1 * e1.a + value2 * e2.a,
+                                  value0 * e0.b + value1 * e1.b + value2 * e2.b,
+                                  value0 * e0.c + value1 * e1.c + value2 * e2.c};
+        };
+
+        out.inv_depth_plane = interpolation_plane(v0.inv_depth, v1.inv_depth, v2.inv_depth);
+        out_attributes.tex_u = interpolation_plane(v0.tex_coord.x, v1.tex_coord.x, v2.tex_coord.x);
+        out_attributes.tex_v = interpolation_plane(v0.tex_coord.y, v1.tex_coord.y, v2.tex_coord.y);
+        out_attributes.normal_x = interpolation_plane(v0.normal.x, v1.normal.x, v2.normal.x);
+        out_attributes.normal_y = interpolation_plane(v0.normal.y, v1.normal.y, v2.normal.y);
+        out_attributes.normal_z = interpolation_plane(v0.normal.z, v1.normal.z, v2.normal.z);
+
+        return setup_result::drawn;
+    }
+
+    void clip_polygon(std::vector<clip_vertex> &polygon, std::vector<clip_vertex> &scratch, std::uint8_t outcode_union, const clip_volume &volume)
+    {
+        // Sutherland-Hodgman against one plane at a time, distance(position) >= 0 is inside
+        auto clip_plane = [&](auto &&distance)
+        {
+            scratch.swap(polygon);
+            polygon.clear();
+
+            for (std::size_t i = 0; i < scratch.size(); ++i)
+            {
+                const clip_vertex &current = scratch[i];
+                const clip_vertex &next = scratch[(i + 1) % scratch.size()];
+                const float d_current = distance(current.position);
+                const float d_next = distance(next.position);
+
+                if (d_current >= 0.0f)
+                    polygon.push_back(current);
+
+                if ((d_current >= 0.0f) != (d_next >= 0.0f))
+                {
+                    const float t = d_current / (d_current - d_next);
+                    polygon.push_back(clip_vertex{math::lerp(current.position, next.position, t),
+                                                  math::lerp(current.tex_coord, next.tex_coord, t),
+                                                  math::lerp(current.normal, next.normal, t),
+                                                  clip_vertex::NEW_VERTEX});
+                }
+            }
+        };
+
+        // Near goes first, so w is positive for the planes after it
+        if (outcode_union & OUTSIDE_NEAR)
+            clip_plane([&](const vector4f &p)
+                       { return p.w - volume.near_clip; });
+        if (outcode_union & OUTSIDE_FAR)
+            clip_plane([&](const vector4f &p)
+                       { return volume.far_clip - p.w; });
+        if (outcode_union & OUTSIDE_GUARD_BAND)
+        {
+            clip_plane([](const vector4f &p)
+                       { return p.x + GUARD_BAND_LIMIT * p.w; });
+            clip_plane([](const vector4f &p)
+                       { return GUARD_BAND_LIMIT * p.w - p.x; });
+            clip_plane([](const vector4f &p)
+                       { return p.y + GUARD_BAND_LIMIT * p.w; });
+            clip_plane([](const vector4f &p)
+                       { return GUARD_BAND_LIMIT * p.w - p.y; });
+        }
+    }
+
+    vector3f vertex_to_screen(const vector3f &vertex, const transform &transform, const vector2f &screen, camera &cam)
     {
         vector3f vertex_world = transform.to_world_position(vertex);
         vector3f vertex_view = cam.camera_transform.to_local_position(vertex_world);
@@ -103,7 +494,23 @@ namespace rasterizer
             (1.0f - ndc.y) * 0.5f * screen.y};
     }
 
-    vector3f vertex_to_view(const vector3f &vertex, transform &transform, camera &cam)
+    matrix4f make_screen_projection(float fov, const vector2f &screen)
+    {
+        const float scale_y = math::tan(fov / 2.0f);
+        const float scale_x = scale_y * screen.x / screen.y;
+
+        // x / w spans 0..screen.x over view x / z in +-scale_x, y is flipped to point down. w is the view depth.
+        matrix4f projection;
+        projection.m[0][0] = 0.5f * screen.x / scale_x;
+        projection.m[0][2] = 0.5f * screen.x;
+        projection.m[1][1] = -0.5f * screen.y / scale_y;
+        projection.m[1][2] = 0.5f * screen.y;
+        projection.m[3][2] = 1.0f;
+        projection.m[3][3] = 0.0f;
+        return projection;
+    }
+
+    vector3f vertex_to_view(const vector3f &vertex, const transform &transform, camera &cam)
     {
         vector3f vertex_world = transform.to_world_position(vertex);
         vector3f vertex_view = cam.camera_transform.to_local_position(vertex_world);
@@ -117,124 +524,214 @@ namespace rasterizer
         return math::atan(desired_half_height) * 2 * 180.0f / math::PI;
     }
 
-    // TODO -> Move this to rasterizer engine later
-    void process_model(rasterizer::model &m, camera &cam, vector2f &screen)
+    // Same planes over model space points, each goes through the transposed model matrix and is renormalized
+    static frustum frustum_to_model_space(const frustum &world, const transform &t)
     {
-        vector3f view_points[3];
-        m.rasterizer_indices.clear();
-        m.rasterizer_data.position.clear();
-        m.rasterizer_data.tex_coords.clear();
-        m.rasterizer_data.normals.clear();
-        m.rasterizer_data.depth.clear();
+        const auto &m = t.get_matrix().m;
 
-        for (unsigned int i = 0; i < m.indices.size(); i += 3)
+        frustum local;
+        for (int i = 0; i < 6; ++i)
         {
-            view_points[0] = vertex_to_view(m.m_mesh.positions[m.indices[i + 0]], m.model_transform, cam);
-            view_points[1] = vertex_to_view(m.m_mesh.positions[m.indices[i + 1]], m.model_transform, cam);
-            view_points[2] = vertex_to_view(m.m_mesh.positions[m.indices[i + 2]], m.model_transform, cam);
+            const frustum_plane &plane = world.planes[i];
+            const vector3f &n = plane.normal;
+            vector3f normal{n.x * m[0][0] + n.y * m[1][0] + n.z * m[2][0],
+                            n.x * m[0][1] + n.y * m[1][1] + n.z * m[2][1],
+                            n.x * m[0][2] + n.y * m[1][2] + n.z * m[2][2]};
+            float d = n.x * m[0][3] + n.y * m[1][3] + n.z * m[2][3] + plane.d;
+            float inv_length = 1.0f / math::sqrt(dot(normal, normal));
+            local.planes[i] = {normal * inv_length, d * inv_length};
+        }
+        return local;
+    }
 
-            constexpr float near_clip = 0.01f;
-            bool clip0 = view_points[0].z <= near_clip;
-            bool clip1 = view_points[1].z <= near_clip;
-            bool clip2 = view_points[2].z <= near_clip;
-            int clip_count = static_cast<int>(clip0) + static_cast<int>(clip1) + static_cast<int>(clip2);
+    // Marks which meshlets of the chunk survive culling in the vertex cache
+    static void cull_meshlets(rasterizer::model &m, geometry_chunk &out, const frustum &local_frustum, const vector3f &local_eye, bool cull_cones)
+    {
+        out.meshlets_culled = 0;
+        for (std::uint32_t meshlet_index = out.first_meshlet; meshlet_index < out.end_meshlet; ++meshlet_index)
+        {
+            const meshlet &cluster = m.meshlets[meshlet_index];
+            const bool visible = local_frustum.intersects(cluster.sphere) && !(cull_cones && cluster.is_backfacing(local_eye));
+            m.transformed_vertices.visible[meshlet_index] = static_cast<std::uint8_t>(visible);
+            out.meshlets_culled += static_cast<std::uint32_t>(!visible);
+        }
+    }
 
-            if (clip_count == 0)
-            {
-                add_vertex_to_rasterizer_points(m, view_points[0], m.indices[i + 0], screen, cam);
-                add_vertex_to_rasterizer_points(m, view_points[1], m.indices[i + 1], screen, cam);
-                add_vertex_to_rasterizer_points(m, view_points[2], m.indices[i + 2], screen, cam);
-            }
-            else if (clip_count == 1)
+    // Transforms the vertices owned by the chunk's meshlets that need them, owned ranges never overlap across chunks
+    static void transform_meshlet_vertices(rasterizer::model &m, const geometry_chunk &out, const matrix4f &model_view_projection, const clip_volume &volume)
+    {
+        vertex_cache &cache = m.transformed_vertices;
+
+        for (std::uint32_t meshlet_index = out.first_meshlet; meshlet_index < out.end_meshlet; ++meshlet_index)
+        {
+            if (!cache.transformed[meshlet_index])
+                continue;
+
+            const meshlet &cluster = m.meshlets[meshlet_index];
+            cache.owned_outcodes[meshlet_index] = transform_vertices(m.vertex_positions, cluster.first_vertex, cluster.vertex_count, model_view_projection,
+                                                                     volume, cache.vertices.data(), cache.outcodes.data());
+        }
+    }
+
+    // Rejects triangles outside the view volume and clips the ones crossing near, far or the guard band,
+    // only clipped corners become new vertices
+    static void assemble_triangles(const rasterizer::model &m, geometry_chunk &out, const matrix4f &model_view_projection, const clip_volume &volume)
+    {
+        const vertex_cache &cache = m.transformed_vertices;
+
+        out.clipped_vertices.position.clear();
+        out.clipped_vertices.tex_coords.clear();
+        out.clipped_vertices.normals.clear();
+        out.clipped_vertices.depth.clear();
+        out.indices.clear();
+        out.triangles_rejected = 0;
+        out.triangles_clipped = 0;
+
+        for (std::uint32_t meshlet_index = out.first_meshlet; meshlet_index < out.end_meshlet; ++meshlet_index)
+        {
+            if (!cache.visible[meshlet_index])
+                continue;
+
+            const meshlet &cluster = m.meshlets[meshlet_index];
+            const std::uint32_t end = cluster.first_index + cluster.index_count;
+
+            // Every vertex inside the view volume, the whole meshlet goes through as it is
+            std::uint8_t outcode_union = cache.owned_outcodes[meshlet_index];
+            for (std::uint32_t l = cluster.first_lender; l < cluster.first_lender + cluster.lender_count; ++l)
+                outcode_union |= cache.owned_outcodes[m.meshlet_lenders[l]];
+
+            if (outcode_union == 0)
             {
-                // Find clipped vertex
-                int clip_index = clip0 ? 0 : (clip1 ? 1 : 2);
-                int keep_a = (clip_index + 1) % 3;
-                int keep_b = (clip_index + 2) % 3;
-
-                vector3f clipped = view_points[clip_index];
-                vector3f a = view_points[keep_a];
-                vector3f b = view_points[keep_b];
-
-                // Intersect clipped->a
-                float t_a = (near_clip - clipped.z) / (a.z - clipped.z);
-                vector3f intersect_a = math::lerp(clipped, a, t_a);
-
-                // Intersect clipped->b
-                float t_b = (near_clip - clipped.z) / (b.z - clipped.z);
-                vector3f intersect_b = math::lerp(clipped, b, t_b);
-
-                int vert_clip = m.indices[i + clip_index];
-                int vert_a = m.indices[i + keep_a];
-                int vert_b = m.indices[i + keep_b];
-
-                // Only one triangle: [intersect_a, a, b], [intersect_a, b, intersect_b]
-                add_vertex_to_rasterizer_points(m, intersect_a, vert_clip, vert_a, t_a, screen, cam);
-                add_vertex_to_rasterizer_points(m, a, vert_a, screen, cam);
-                add_vertex_to_rasterizer_points(m, b, vert_b, screen, cam);
-
-                add_vertex_to_rasterizer_points(m, intersect_a, vert_clip, vert_a, t_a, screen, cam);
-                add_vertex_to_rasterizer_points(m, b, vert_b, screen, cam);
-                add_vertex_to_rasterizer_points(m, intersect_b, vert_clip, vert_b, t_b, screen, cam);
+                out.indices.insert(out.indices.end(), m.indices.begin() + cluster.first_index, m.indices.begin() + end);
+                continue;
             }
-            else if (clip_count == 2)
+
+            for (unsigned int i = cluster.first_index; i < end; i += 3)
             {
-                // Find non-clipped vertex
-                int keep_index = (!clip0) ? 0 : (!clip1) ? 1
-                                                         : 2;
-                int clip_a = (keep_index + 1) % 3;
-                int clip_b = (keep_index + 2) % 3;
-
-                vector3f keep = view_points[keep_index];
-                vector3f clipped_a = view_points[clip_a];
-                vector3f clipped_b = view_points[clip_b];
-
-                float t_a = (near_clip - keep.z) / (clipped_a.z - keep.z);
-                float t_b = (near_clip - keep.z) / (clipped_b.z - keep.z);
-
-                vector3f intersect_a = math::lerp(keep, clipped_a, t_a);
-                vector3f intersect_b = math::lerp(keep, clipped_b, t_b);
-
-                int vert_keep = m.indices[i + keep_index];
-                int vert_a = m.indices[i + clip_a];
-                int vert_b = m.indices[i + clip_b];
-
-                // Only one triangle: [keep, intersect_a, intersect_b]
-                add_vertex_to_rasterizer_points(m, keep, vert_keep, screen, cam);
-                add_vertex_to_rasterizer_points(m, intersect_a, vert_keep, vert_a, t_a, screen, cam);
-                add_vertex_to_rasterizer_points(m, intersect_b, vert_keep, vert_b, t_b, screen, cam);
+                const unsigned int vertex_indices[3] = {m.indices[i + 0], m.indices[i + 1], m.indices[i + 2]};
+                const std::uint8_t outcode0 = cache.outcodes[vertex_indices[0]];
+                const std::uint8_t outcode1 = cache.outcodes[vertex_indices[1]];
+                const std::uint8_t outcode2 = cache.outcodes[vertex_indices[2]];
+
+                // All three corners outside the same plane
+                if (outcode0 & outcode1 & outcode2 & OUTSIDE_VIEW_VOLUME)
+                {
+                    ++out.triangles_rejected;
+                    continue;
+                }
+
+                // Crossing the screen edges is left to the rasterizer
+                const std::uint8_t triangle_union = outcode0 | outcode1 | outcode2;
+                if (!(triangle_union & NEEDS_CLIPPING))
+                {
+                    out.indices.insert(out.indices.end(), {vertex_indices[0], vertex_indices[1], vertex_indices[2]});
+                    continue;
+                }
+
+                // The cache only keeps projected positions, clipping needs them before the divide.
+                // Projection is linear before the divide, so lerping clip positions matches lerping view positions.
+                out.clipping_polygon.clear();
+                for (unsigned int vertex_index : vertex_indices)
+                    out.clipping_polygon.push_back(clip_vertex{transform_point(model_view_projection, m.m_mesh.positions[vertex_index]),
+                                                           m.m_mesh.tex_coords[vertex_index],
+                                                           m.m_mesh.normals[vertex_index],
+                                                           vertex_index});
+
+                clip_polygon(out.clipping_polygon, out.clipping_scratch, triangle_union, volume);
+                if (out.clipping_polygon.size() < 3)
+                {
+                    ++out.triangles_rejected;
+                    continue;
+                }
+                ++out.triangles_clipped;
+
+                // Corners that survived keep their cache entry
+                for (clip_vertex &vertex : out.clipping_polygon)
+                    if (vertex.index == clip_vertex::NEW_VERTEX)
+                        vertex.index = add_vertex_to_rasterizer_points(m, out, vertex);
+
+                // The clipped polygon stays convex, so it fans out from its first corner
+                for (std::size_t v = 1; v + 1 < out.clipping_polygon.size(); ++v)
+                    out.indices.insert(out.indices.end(), {out.clipping_polygon[0].index, out.clipping_polygon[v].index, out.clipping_polygon[v + 1].index});
             }
-            // If all clipped, skip
         }
     }
 
-    void add_vertex_to_rasterizer_points(rasterizer::model &m, vector3f view_point, int vert_index, vector2f &screen, camera &cam)
+    // TODO -> Move this to rasterizer engine later
+    void process_model(rasterizer::model &m, camera &cam, const frustum &view_frustum, vector2f &screen, job_system &jobs, frame_stats &stats)
     {
-        vector2f screen_pos = view_to_screen(view_point, screen, cam);
-        vector2f tex_coord = m.m_mesh.tex_coords[vert_index];
-        vector3f normal = m.m_mesh.normals[vert_index];
-        float depth = view_point.z;
+        // The vertex kernel loads whole SIMD groups from the stream, a stale one would be read past its end
+        assert(m.vertex_positions.x.size() == m.m_mesh.positions.size() &&
+               m.vertex_positions.y.size() == m.m_mesh.positions.size() &&
+               m.vertex_positions.z.size() == m.m_mesh.positions.size());
+
+        // Meshlets are culled in model space, so neither their spheres nor their cones need transforming
+        const frustum local_frustum = frustum_to_model_space(view_frustum, m.get_transform());
+        const vector3f local_eye = m.get_transform().to_local_position(cam.camera_transform.position);
+
+        // Cones only bound faces that are back-facing in model space. Setup flips the culled winding of
+        // mirrored models, so back mode culls those same faces either way.
+        const bool cull_cones = m.face_culling == cull_mode::back;
+
+        // Chunks are whole runs of meshlets
+        const std::uint32_t meshlet_count = static_cast<std::uint32_t>(m.meshlets.size());
+        const int chunk_count = math::min(geometry_chunk_count(m.indices.size() / 3, jobs), static_cast<int>(meshlet_count));
+        const std::uint32_t meshlets_per_chunk = chunk_count > 0 ? (meshlet_count + chunk_count - 1) / chunk_count : 0;
+        m.geometry_chunks.resize(chunk_count);
+        for (int chunk = 0; chunk < chunk_count; ++chunk)
+        {
+            geometry_chunk &out = m.geometry_chunks[chunk];
+            out.first_meshlet = math::min(chunk * meshlets_per_chunk, meshlet_count);
+            out.end_meshlet = math::min(out.first_meshlet + meshlets_per_chunk, meshlet_count);
+        }
+
+        vertex_cache &cache = m.transformed_vertices;
+        cache.vertices.resize(m.m_mesh.positions.size());
+        cache.outcodes.resize(m.m_mesh.positions.size());
+        cache.owned_outcodes.resize(meshlet_count);
+        cache.visible.resize(meshlet_count);
 
-        m.rasterizer_data.position.emplace_back(screen_pos);
-        m.rasterizer_data.tex_coords.emplace_back(tex_coord);
-        m.rasterizer_data.normals.emplace_back(normal);
-        m.rasterizer_data.depth.emplace_back(depth);
+        jobs.parallel_for(chunk_count, [&](int chunk)
+                          { cull_meshlets(m, m.geometry_chunks[chunk], local_frustum, local_eye, cull_cones); });
 
-        m.rasterizer_indices.push_back(m.rasterizer_data.position.size() - 1);
+        // Visible meshlets need their own vertices and the ones their lenders own
+        cache.transformed.assign(meshlet_count, 0);
+        for (std::uint32_t meshlet_index = 0; meshlet_index < meshlet_count; ++meshlet_index)
+        {
+            if (!cache.visible[meshlet_index])
+                continue;
+
+            const meshlet &cluster = m.meshlets[meshlet_index];
+            cache.transformed[meshlet_index] = 1;
+            for (std::uint32_t l = cluster.first_lender; l < cluster.first_lender + cluster.lender_count; ++l)
+                cache.transformed[m.meshlet_lenders[l]] = 1;
+        }
+
+        // One matrix per vertex, every vertex is written before any triangle reads it, so the passes stay apart
+        const matrix4f model_view_projection = cam.get_view_projection(screen) * m.get_transform().get_matrix();
+        const clip_volume volume{screen.x, screen.y, cam.near_clip, cam.far_clip};
+        jobs.parallel_for(chunk_count, [&](int chunk)
+                          { transform_meshlet_vertices(m, m.geometry_chunks[chunk], model_view_projection, volume); });
+        jobs.parallel_for(chunk_count, [&](int chunk)
+                          { assemble_triangles(m, m.geometry_chunks[chunk], model_view_projection, volume); });
+
+        for (const geometry_chunk &out : m.geometry_chunks)
+        {
+            stats.meshlets_culled += out.meshlets_culled;
+            stats.triangles_rejected += out.triangles_rejected;
+            stats.triangles_clipped += out.triangles_clipped;
+        }
     }
 
-    void add_vertex_to_rasterizer_points(rasterizer::model &m, vector3f view_point, int vert_index_a, int vert_index_b, float t, vector2f &screen, camera &cam)
+    unsigned int add_vertex_to_rasterizer_points(const rasterizer::model &m, geometry_chunk &out, const clip_vertex &vertex)
     {
-        vector2f screen_pos = view_to_screen(view_point, screen, cam);
-        vector2f tex_coord = math::lerp(m.m_mesh.tex_coords[vert_index_a], m.m_mesh.tex_coords[vert_index_b], t);
-        vector3f normal = math::lerp(m.m_mesh.normals[vert_index_a], m.m_mesh.normals[vert_index_b], t);
-        float depth = view_point.z;
+        const float inv_w = 1.0f / vertex.position.w;
+        out.clipped_vertices.position.emplace_back(vertex.position.x * inv_w, vertex.position.y * inv_w);
+        out.clipped_vertices.tex_coords.emplace_back(vertex.tex_coord);
+        out.clipped_vertices.normals.emplace_back(vertex.normal);
+        out.clipped_vertices.depth.emplace_back(vertex.position.w);
 
-        m.rasterizer_data.position.emplace_back(screen_pos);
-        m.rasterizer_data.tex_coords.emplace_back(tex_coord);
-        m.rasterizer_data.normals.emplace_back(normal);
-        m.rasterizer_data.depth.emplace_back(depth);
-        m.rasterizer_indices.push_back(m.rasterizer_data.position.size() - 1);
+        return static_cast<unsigned int>(m.m_mesh.positions.size() + out.clipped_vertices.position.size() - 1);
     }
 
 }
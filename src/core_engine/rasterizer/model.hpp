@@ -1,24 +1,125 @@
 #pragma once
 
+#include <cstdint>
 #include <tuple>
 #include <vector>
 
+#include "rasterizer/frame_stats.hpp"
+#include "rasterizer/job_system.hpp"
+#include "rasterizer/meshlet.hpp"
 #include "rasterizer/types.hpp"
 #include "rasterizer/types_math.hpp"
+#include "rasterizer/vertex_kernel.hpp"
 #include "shader/shader.hpp"
 
 namespace rasterizer
 {
+    // Linear function over screen space, a * x + b * y + c.
+    // Used for 1 / depth and for every attribute divided by depth.
+    struct plane_equation
+    {
+        float a, b, c;
+
+        float evaluate(float x, float y) const { return a * x + b * y + c; }
+    };
+
+    //
+    // Fixed-Point Setup
+    //
+
+    // Vertices snap to 1 / SUBPIXEL_SCALE of a pixel before the edge functions are built
+    constexpr int SUBPIXEL_BITS = 8;
+    constexpr std::int64_t SUBPIXEL_SCALE = std::int64_t{1} << SUBPIXEL_BITS;
+
+    // Snapped vertices stay within +-FIXED_POINT_LIMIT pixels, so every edge function term fits in 64 bits.
+    // The geometry stage clips triangles to the guard band, well inside that range, before setup.
+    constexpr float FIXED_POINT_LIMIT = static_cast<float>(1 << 21);
+    static_assert(GUARD_BAND_LIMIT * 2.0f <= FIXED_POINT_LIMIT, "clipped corners must stay in the fixed-point range");
+
+    // Fixed-point coordinate of the center of pixel x
+    constexpr std::int64_t pixel_center_fixed(int x)
+    {
+        return (static_cast<std::int64_t>(x) << SUBPIXEL_BITS) + SUBPIXEL_SCALE / 2;
+    }
+
+    // Rounds a pixel coordinate to the nearest sub-pixel, only valid within +-FIXED_POINT_LIMIT
+    inline std::int64_t to_fixed(float pixels)
+    {
+        const float scaled = pixels * static_cast<float>(SUBPIXEL_SCALE) + 0.5f;
+        const std::int64_t truncated = static_cast<std::int64_t>(scaled);
+
+        // Truncation rounds negative values up, step those back down to get floor
+        return truncated - static_cast<std::int64_t>(scaled < static_cast<float>(truncated));
+    }
+
+    // Integer edge function over fixed-point coordinates, a pixel center is covered when a * x + b * y + c >= 0.
+    // The top-left fill rule is folded into c, so pixels on an edge shared by two triangles are drawn once.
+    // a and b are coordinate differences and fit in 32 bits within the fixed-point range.
+    struct edge_equation
+    {
+        std::int32_t a, b;
+        std::int64_t c;
+
+        std::int64_t evaluate(std::int64_t x, std::int64_t y) const { return a * x + b * y + c; }
+    };
+
+    // What binning and the raster kernels read for every triangle they visit.
+    // Its planes are evaluated at offsets from (minX, minY), which keeps c close to the interpolated values
+    // instead of growing with the screen position and losing precision to cancellation.
     struct triangle_data
     {
-        vector2f p0, p1, p2;
         float minX, maxX, minY, maxY;
-        unsigned int idx0, idx1, idx2;
-        vector3f inv_depth;
-        vector2f tx, ty, tz;
-        vector3f nx, ny, nz;
+        vector3f inv_depth; // Per corner, bounds the nearest depth
+        plane_equation inv_depth_plane;
+        edge_equation edge0, edge1, edge2; // Coverage, inv_depth_plane interpolates
+    };
+    static_assert(sizeof(triangle_data) == 96, "triangle_data is read for every binned triangle, keep it small");
+
+    // Attributes divided by depth as planes, only read for fragments that passed the depth test.
+    // An attribute at a pixel is its plane there times the depth. Same index and plane origin as the
+    // triangle_data they belong to.
+    struct triangle_attributes
+    {
+        plane_equation tex_u, tex_v;
+        plane_equation normal_x, normal_y, normal_z;
+    };
+
+    // One corner going into triangle setup, the attributes are already divided by depth
+    // so all of them are linear in screen space
+    struct setup_vertex
+    {
+        vector2f position;
+        float inv_depth;
+        vector2f tex_coord;
+        vector3f normal;
+    };
+
+    enum class setup_result : std::uint8_t
+    {
+        drawn,
+        degenerate, // Zero area after snapping
+        culled      // Wound like culled_orientation
     };
 
+    // Snaps the corners and builds the edge and plane equations. culled_orientation is the sign of the
+    // screen space area to reject, +1 or -1, with y pointing down. 0 keeps both windings.
+    setup_result setup_triangle(const setup_vertex &v0, const setup_vertex &v1, const setup_vertex &v2, triangle_data &out,
+                                triangle_attributes &out_attributes, std::int64_t culled_orientation = 0);
+
+    // One corner of a triangle being clipped in clip space, where attributes are linear too
+    struct clip_vertex
+    {
+        static constexpr unsigned int NEW_VERTEX = ~0u;
+
+        vector4f position;
+        vector2f tex_coord;
+        vector3f normal;
+        unsigned int index; // Vertex cache index of an original corner, NEW_VERTEX for corners clipping made
+    };
+
+    // Sutherland-Hodgman against the near, far and guard band planes named in outcode_union
+    void clip_polygon(std::vector<clip_vertex> &polygon, std::vector<clip_vertex> &scratch, std::uint8_t outcode_union, const clip_volume &volume);
+
     struct transform
     {
         float yaw = 0;
@@ -26,26 +127,50 @@ namespace rasterizer
         vector3f position{0, 0, 0};
         vector3f scale{1.0f, 1.0f, 1.0f};
 
-        vector3f to_world_position(vector3f local_point)
+        // Negative scale on an odd number of axes flips the winding of every triangle
+        bool is_mirrored() const { return scale.x * scale.y * scale.z < 0.0f; }
+
+        // Compares the fields, not the cached matrices
+        bool same_placement(const transform &other) const
         {
-            auto [ihat, jhat, khat] = get_basis_vector();
-            ihat *= scale.x;
-            jhat *= scale.y;
-            khat *= scale.z;
-            return transform_vector(ihat, jhat, khat, local_point) + position;
+            return yaw == other.yaw && pitch == other.pitch &&
+                   position.x == other.position.x && position.y == other.position.y && position.z == other.position.z &&
+                   scale.x == other.scale.x && scale.y == other.scale.y && scale.z == other.scale.z;
+        }
+
+        // Local to world and back. Only rebuilt when a field changed since they were last built, which is
+        // not thread safe, so get them once before handing the transform to jobs.
+        const matrix4f &get_matrix() const
+        {
+            update_matrices();
+            return m_matrix;
         }
 
-        vector3f to_local_position(vector3f world_point)
+        const matrix4f &get_inverse_matrix() const
         {
-            auto [ihat, jhat, khat] = get_inverse_basis_vector();
-            vector3f local = transform_vector(ihat, jhat, khat, world_point - position);
-            local.x /= scale.x;
-            local.y /= scale.y;
-            local.z /= scale.z;
-            return local;
+            update_matrices();
+            return m_inverse_matrix;
         }
 
-        std::tuple<vector3f, vector3f, vector3f> get_basis_vector()
+        // Taken from one counter shared by every transform each time the matrices are rebuilt. Copies keep
+        // it along with the matrices, so equal versions always mean equal matrices.
+        std::uint64_t get_matrix_version() const
+        {
+            update_matrices();
+            return m_matrix_version;
+        }
+
+        vector3f to_world_position(vector3f local_point) const
+        {
+            return transform_position(get_matrix(), local_point);
+        }
+
+        vector3f to_local_position(vector3f world_point) const
+        {
+            return transform_position(get_inverse_matrix(), world_point);
+        }
+
+        std::tuple<vector3f, vector3f, vector3f> get_basis_vector() const
         {
             vector3f ihat_yaw = {math::cos(yaw), 0, -math::sin(yaw)};
             vector3f jhat_yaw = {0, 1, 0};
@@ -61,7 +186,7 @@ namespace rasterizer
             return std::make_tuple(ihat, jhat, khat);
         }
 
-        std::tuple<vector3f, vector3f, vector3f> get_inverse_basis_vector()
+        std::tuple<vector3f, vector3f, vector3f> get_inverse_basis_vector() const
         {
             auto [ihat, jhat, khat] = get_basis_vector();
             vector3f ihat_inverse{ihat.x, jhat.x, khat.x};
@@ -71,19 +196,33 @@ namespace rasterizer
             return std::make_tuple(ihat_inverse, jhat_inverse, khat_inverse);
         }
 
-        vector3f transform_vector(vector3f ihat, vector3f jhat, vector3f khat, vector3f vec)
+        vector3f transform_vector(vector3f ihat, vector3f jhat, vector3f khat, vector3f vec) const
         {
             return {
                 vec.x * ihat.x + vec.y * jhat.x + vec.z * khat.x,
                 vec.x * ihat.y + vec.y * jhat.y + vec.z * khat.y,
                 vec.x * ihat.z + vec.y * jhat.z + vec.z * khat.z};
         }
+
+    private:
+        // The fields the matrices were built from, the version stays 0 until they are built once
+        mutable float m_matrix_yaw = 0;
+        mutable float m_matrix_pitch = 0;
+        mutable vector3f m_matrix_position{0, 0, 0};
+        mutable vector3f m_matrix_scale{1.0f, 1.0f, 1.0f};
+        mutable std::uint64_t m_matrix_version = 0;
+        mutable matrix4f m_matrix;
+        mutable matrix4f m_inverse_matrix;
+
+        void update_matrices() const;
     };
 
     struct camera
     {
         transform camera_transform;
         float fov = math::to_radians(90.0f);
+        float near_clip = 0.01f;
+        float far_clip = 1000.0f;
         float cam_speed = 5.0f;
         float mouse_sensitivity = 2.0f;
 
@@ -105,18 +244,121 @@ namespace rasterizer
             camera_transform.position += normalized_vector(move_delta) * cam_speed * delta_time;
             camera_transform.position.y = 1;
         }
+
+        // World space to screen pixels, x and y come out multiplied by w, which is the view depth.
+        // Only rebuilt when the camera moved or the fov or screen size changed.
+        const matrix4f &get_view_projection(const vector2f &screen);
+
+    private:
+        matrix4f m_view_projection;
+        std::uint64_t m_view_version = 0;
+        float m_projection_fov = 0.0f;
+        vector2f m_projection_screen;
+    };
+
+    //
+    // Bounds and Culling
+    //
+
+    struct model_bounds
+    {
+        bounding_box box;
+        bounding_sphere sphere;
+    };
+
+    // Unit normal plane, points with dot(normal, p) + d >= 0 are on the inner side
+    struct frustum_plane
+    {
+        vector3f normal;
+        float d = 0.0f;
+
+        float distance(const vector3f &point) const { return dot(normal, point) + d; }
+    };
+
+    // World space view volume, near, far, left, right, bottom, top
+    struct frustum
+    {
+        static constexpr std::uint32_t ALL_PLANES = (1u << 6) - 1;
+
+        frustum_plane planes[6];
+
+        // Only tests the planes set in plane_mask
+        bool intersects(const bounding_sphere &sphere, std::uint32_t plane_mask = ALL_PLANES) const;
+
+        // Also clears the planes the box is fully inside of, anything within the box can skip those
+        bool intersects(const bounding_box &box, std::uint32_t &plane_mask) const;
+    };
+
+    // Needs the camera vectors from update_camera_vectors to be current
+    frustum make_frustum(const camera &cam, float aspect_ratio);
+
+    // Geometry work is split into chunks of at least this many triangles
+    constexpr std::uint32_t MIN_TRIANGLES_PER_GEOMETRY_CHUNK = 1024;
+
+    // Post-transform vertex cache, indexed like the mesh vertices. Each frame only the vertices owned by
+    // visible meshlets, or by meshlets lending vertices to one, are transformed, each of them once.
+    struct vertex_cache
+    {
+        std::vector<transformed_vertex> vertices;
+        std::vector<std::uint8_t> outcodes;
+
+        // Per meshlet
+        std::vector<std::uint8_t> visible;
+        std::vector<std::uint8_t> transformed;
+        std::vector<std::uint8_t> owned_outcodes; // Outcodes of its owned vertices or-ed together
+    };
+
+    // One run of meshlets going through the geometry front-end. Chunks run in parallel and their triangles
+    // are concatenated in chunk order, so the result does not depend on the thread count.
+    // Kept on the model so capacity is reused every frame.
+    struct geometry_chunk
+    {
+        std::uint32_t first_meshlet = 0;
+        std::uint32_t end_meshlet = 0;
+
+        // Written by process_model. Indices below the mesh vertex count point into the vertex cache,
+        // the rest into clipped_vertices, which only holds the new corners made by clipping.
+        rasterizer_data_sao clipped_vertices;
+        std::vector<unsigned int> indices;
+        std::uint32_t meshlets_culled = 0;
+        std::uint32_t triangles_rejected = 0;
+        std::uint32_t triangles_clipped = 0;
+
+        // Reused between frames by the clipper
+        std::vector<clip_vertex> clipping_polygon;
+        std::vector<clip_vertex> clipping_scratch;
+
+        // Written by fill_triangle_data
+        std::vector<triangle_data> triangles;
+        std::vector<triangle_attributes> attributes;
+        std::uint32_t triangles_culled = 0;
+
+        // Where this chunk's triangles start in triangles_data
+        std::size_t triangle_offset = 0;
+    };
+
+    // Which facing gets discarded, front faces wind counter-clockwise in model space
+    enum class cull_mode
+    {
+        none,
+        back,
+        front
     };
 
     struct model
     {
         mesh_data m_mesh;
-        std::vector<unsigned int> indices;
-        transform model_transform;
+        std::vector<unsigned int> indices; // Reordered into meshlet order by set_mesh
+        std::vector<meshlet> meshlets;
+        std::vector<std::uint32_t> meshlet_lenders;
+        position_stream vertex_positions; // m_mesh.positions split per axis for the vertex kernel, rebuilt by set_mesh
+        cull_mode face_culling = cull_mode::none;
         const shader *shader_ptr;
         std::vector<vector3f> triangle_colors;
         std::vector<triangle_data> triangles_data;
-        rasterizer_data_sao rasterizer_data;
-        std::vector<unsigned int> rasterizer_indices;
+        std::vector<triangle_attributes> triangle_attributes_data; // Parallel to triangles_data
+        vertex_cache transformed_vertices;
+        std::vector<geometry_chunk> geometry_chunks;
 
         model(
             const mesh_data &mesh,
@@ -124,15 +366,61 @@ namespace rasterizer
             const transform &modelTransform,
             const shader *shaderPtr = nullptr,
             const std::vector<vector3f> &tri_cols = std::vector<vector3f>())
-            : m_mesh(std::move(mesh)),
-              indices(std::move(inds)),
-              model_transform(std::move(modelTransform)),
-              shader_ptr(shaderPtr),
-              triangle_colors(std::move(tri_cols))
+            : shader_ptr(shaderPtr),
+              triangle_colors(std::move(tri_cols)),
+              m_transform(std::move(modelTransform))
+        {
+            set_mesh(mesh, inds);
+        }
+
+        // Replaces the mesh and rebuilds everything derived from it: the meshlets, the vertex and index order,
+        // the position stream and the bounds. Never change m_mesh or indices directly.
+        void set_mesh(const mesh_data &mesh, const std::vector<unsigned int> &mesh_indices);
+
+        // Sets up the triangles process_model projected across jobs, returns the number rejected by face_culling
+        std::uint32_t fill_triangle_data(job_system &jobs);
+
+        const model_bounds &get_local_bounds() const { return m_local_bounds; }
+
+        const transform &get_transform() const { return m_transform; }
+
+        // Moves the model and reports it to the scene BVH tracking it, so only moved models get refit
+        void set_transform(const transform &model_transform)
         {
+            m_transform = model_transform;
+            if (m_moved_models)
+                m_moved_models->push_back(m_scene_index);
         }
 
-        void fill_triangle_data();
+        // Called by the scene BVH for every model it is built from, set_transform reports index to moved_models
+        void track_moves(std::vector<std::uint32_t> *moved_models, std::uint32_t index)
+        {
+            m_moved_models = moved_models;
+            m_scene_index = index;
+        }
+
+        // Recomputes the world space bounds when the transform changed since the last call, true if it did
+        bool update_world_bounds();
+
+        const model_bounds &get_world_bounds()
+        {
+            update_world_bounds();
+            return m_world_bounds;
+        }
+
+    private:
+        transform m_transform;
+        std::vector<std::uint32_t> *m_moved_models = nullptr;
+        std::uint32_t m_scene_index = 0;
+
+        model_bounds m_local_bounds;
+        model_bounds m_world_bounds;
+        transform m_world_bounds_transform;
+        bool m_world_bounds_valid = false;
+
+        void compute_local_bounds();
+
+        void setup_triangles(geometry_chunk &out, std::int64_t culled_orientation) const;
     };
 
     // TODO -> Maybe move this to camera class
@@ -140,16 +428,20 @@ namespace rasterizer
 
     vector2f view_to_screen(const vector3f &view_point, const vector2f &screen, camera &cam);
 
+    // View space to screen pixels with the same mapping as view_to_screen, before the divide by w
+    matrix4f make_screen_projection(float fov, const vector2f &screen);
+
     vector3f vertex_to_view(const vector3f &vertex, const transform &transform, camera &cam);
 
     // TODO -> Move this later
     float calculate_dolly_zoom_fov(float fovInitial, float zPosInitial, float zPosCurrent);
 
     // TODO -> Move this later
-    void process_model(rasterizer::model &m, camera &cam, vector2f &screen);
-
-    void add_vertex_to_rasterizer_points(rasterizer::model &m, vector3f view_point, int vert_index, vector2f &screen, camera &cam);
+    // Runs chunks of meshlets across jobs, adds the meshlets culled and the triangles rejected or clipped to stats.
+    // view_frustum is the frame's world-space frustum from make_frustum.
+    void process_model(rasterizer::model &m, camera &cam, const frustum &view_frustum, vector2f &screen, job_system &jobs, frame_stats &stats);
 
-    void add_vertex_to_rasterizer_points(rasterizer::model &m, vector3f view_point, int vert_index_a, int vert_index_b, float t, vector2f &screen, camera &cam);
+    // Adds a corner made by clipping, returns the index triangles refer to it by
+    unsigned int add_vertex_to_rasterizer_points(const rasterizer::model &m, geometry_chunk &out, const clip_vertex &vertex);
 
 }
\ No newline at end of file
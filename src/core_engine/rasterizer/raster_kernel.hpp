@@ -0,0 +1,421 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+#include "helper/simd_math.hpp"
+#include "rasterizer/frame_stats.hpp"
+#include "rasterizer/model.hpp"
+#include "rasterizer/types.hpp"
+#include "rasterizer/types_math.hpp"
+
+namespace rasterizer
+{
+    //
+    // Raster Kernels
+    //
+    // The kernels rasterize one triangle clipped to one tile, depth test and write covered pixels,
+    // and hand every visible fragment to shade_fragment(pixel_index, x, y, depth).
+    // Only 1 / depth is interpolated here, attributes are left to whoever shades the fragment.
+    //
+
+    // Pixel bounds of the triangle inside the tile, false when they don't overlap
+    inline bool triangle_tile_bounds(const triangle_data &triangle, const screen_tile &tile,
+                                     int &x_start, int &x_end, int &y_start, int &y_end)
+    {
+        x_start = math::max(tile.min_x, static_cast<int>(math::floor(math::max(triangle.minX, static_cast<float>(tile.min_x)))));
+        x_end = math::min(tile.max_x, static_cast<int>(math::ceil(math::min(triangle.maxX, static_cast<float>(tile.max_x)))));
+        y_start = math::max(tile.min_y, static_cast<int>(math::floor(math::max(triangle.minY, static_cast<float>(tile.min_y)))));
+        y_end = math::min(tile.max_y, static_cast<int>(math::ceil(math::min(triangle.maxY, static_cast<float>(tile.max_y)))));
+
+        return x_start < x_end && y_start < y_end;
+    }
+
+    template <typename F>
+    inline void rasterize_triangle_scalar(const triangle_data &triangle, const screen_tile &tile,
+                                          float *depth_buffer, int width, F &&shade_fragment)
+    {
+        int x_start, x_end, y_start, y_end;
+        if (!triangle_tile_bounds(triangle, tile, x_start, x_end, y_start, y_end))
+            return;
+
+        const std::int64_t step0 = triangle.edge0.a * SUBPIXEL_SCALE;
+        const std::int64_t step1 = triangle.edge1.a * SUBPIXEL_SCALE;
+        const std::int64_t step2 = triangle.edge2.a * SUBPIXEL_SCALE;
+
+        for (int y = y_start; y < y_end; ++y)
+        {
+            const std::int64_t sample_x = pixel_center_fixed(x_start);
+            const std::int64_t sample_y = pixel_center_fixed(y);
+            std::int64_t edge0 = triangle.edge0.evaluate(sample_x, sample_y);
+            std::int64_t edge1 = triangle.edge1.evaluate(sample_x, sample_y);
+            std::int64_t edge2 = triangle.edge2.evaluate(sample_x, sample_y);
+
+            for (int x = x_start; x < x_end; ++x, edge0 += step0, edge1 += step1, edge2 += step2)
+            {
+                // All three are non-negative exactly when their OR is
+                if ((edge0 | edge1 | edge2) < 0)
+                    continue;
+
+                float px = static_cast<float>(x) + 0.5f;
+                float py = static_cast<float>(y) + 0.5f;
+                float interpolated_z = 1.0f / triangle.inv_depth_plane.evaluate(px - triangle.minX, py - triangle.minY);
+                int idx = y * width + x;
+
+                if (interpolated_z >= depth_buffer[idx])
+                    continue;
+
+                depth_buffer[idx] = interpolated_z;
+
+                shade_fragment(idx, px, py, interpolated_z);
+            }
+        }
+    }
+
+    //
+    // SIMD Helpers
+    //
+
+    // Per triangle constants shared by the SIMD kernels
+    struct simd_triangle_setup
+    {
+        simd::float_v inv_depth_a, inv_depth_step;
+        simd::int64_v edge_offset0, edge_offset1, edge_offset2;
+        simd::int64_v edge_step0, edge_step1, edge_step2;
+
+        explicit simd_triangle_setup(const triangle_data &triangle)
+            : inv_depth_a(simd::set1(triangle.inv_depth_plane.a)),
+              inv_depth_step(simd::set1(triangle.inv_depth_plane.a * simd::WIDTH)),
+              edge_offset0(simd::lane_multiples_i64(triangle.edge0.a * SUBPIXEL_SCALE)),
+              edge_offset1(simd::lane_multiples_i64(triangle.edge1.a * SUBPIXEL_SCALE)),
+              edge_offset2(simd::lane_multiples_i64(triangle.edge2.a * SUBPIXEL_SCALE)),
+              edge_step0(simd::set1_i64(triangle.edge0.a * SUBPIXEL_SCALE * simd::WIDTH)),
+              edge_step1(simd::set1_i64(triangle.edge1.a * SUBPIXEL_SCALE * simd::WIDTH)),
+              edge_step2(simd::set1_i64(triangle.edge2.a * SUBPIXEL_SCALE * simd::WIDTH))
+        {
+        }
+    };
+
+    // Exact fixed-point edge values of simd::WIDTH consecutive pixels, stepped along a row with one add per edge
+    struct simd_edge_lanes
+    {
+        simd::int64_v e0, e1, e2;
+
+        simd_edge_lanes(const simd_triangle_setup &setup, const triangle_data &triangle, int x, int y)
+            : e0(simd::add(simd::set1_i64(triangle.edge0.evaluate(pixel_center_fixed(x), pixel_center_fixed(y))), setup.edge_offset0)),
+              e1(simd::add(simd::set1_i64(triangle.edge1.evaluate(pixel_center_fixed(x), pixel_center_fixed(y))), setup.edge_offset1)),
+              e2(simd::add(simd::set1_i64(triangle.edge2.evaluate(pixel_center_fixed(x), pixel_center_fixed(y))), setup.edge_offset2))
+        {
+        }
+
+        void step(const simd_triangle_setup &setup)
+        {
+            e0 = simd::add(e0, setup.edge_step0);
+            e1 = simd::add(e1, setup.edge_step1);
+            e2 = simd::add(e2, setup.edge_step2);
+        }
+
+        // Lanes inside all three edges
+        simd::float_v coverage() const
+        {
+            return simd::mask_from_bits(~(simd::sign_mask(e0) | simd::sign_mask(e1) | simd::sign_mask(e2)) & simd::FULL_MASK);
+        }
+    };
+
+    // Lanes of the group starting at x that fall inside [x_start, x_end)
+    inline simd::float_v lane_range_mask(int x, int x_start, int x_end)
+    {
+        const simd::float_v lane = simd::lane_offsets();
+        return simd::bit_and(simd::cmp_ge(lane, simd::set1(static_cast<float>(x_start - x))),
+                             simd::cmp_lt(lane, simd::set1(static_cast<float>(x_end - x))));
+    }
+
+    // Depth test and write the covered lanes of one group, then shade the lanes that survived.
+    // Groups start at multiples of simd::WIDTH from the tile origin, so a group never crosses into
+    // a neighbouring tile and the masked read-modify-write of the depth stays private to this thread.
+    template <typename F>
+    inline bool shade_group(simd::float_v covered, simd::float_v inv_depth,
+                            int x, int y, float *depth_buffer, int width, F &&shade_fragment)
+    {
+        const simd::float_v z = simd::div(simd::set1(1.0f), inv_depth);
+
+        const int idx = y * width + x;
+        float *depth_row = depth_buffer + idx;
+
+        // The last group of a row can run past the screen edge, go through a small copy there
+        const bool full_group = x + simd::WIDTH <= width;
+        alignas(32) float depth_lanes[simd::WIDTH];
+        if (!full_group)
+        {
+            for (int i = 0; i < simd::WIDTH; ++i)
+                depth_lanes[i] = (x + i < width) ? depth_row[i] : 0.0f;
+        }
+
+        const simd::float_v old_depth = simd::load(full_group ? depth_row : depth_lanes);
+        const simd::float_v visible = simd::bit_and(covered, simd::cmp_lt(z, old_depth));
+
+        int visible_bits = simd::move_mask(visible);
+        if (visible_bits == 0)
+            return false;
+
+        const simd::float_v new_depth = simd::select(visible, z, old_depth);
+        if (full_group)
+        {
+            simd::store(depth_row, new_depth);
+        }
+        else
+        {
+            simd::store(depth_lanes, new_depth);
+            for (int i = 0; x + i < width && i < simd::WIDTH; ++i)
+                depth_row[i] = depth_lanes[i];
+        }
+
+        alignas(32) float z_lanes[simd::WIDTH];
+        simd::store(z_lanes, z);
+
+        const float py = static_cast<float>(y) + 0.5f;
+        while (visible_bits)
+        {
+            const int i = std::countr_zero(static_cast<unsigned int>(visible_bits));
+            visible_bits &= visible_bits - 1;
+
+            shade_fragment(idx + i, static_cast<float>(x + i) + 0.5f, py, z_lanes[i]);
+        }
+
+        return true;
+    }
+
+    // Evaluates the edge equations for simd::WIDTH pixels of a row at once and steps them with one add
+    template <typename F>
+    inline void rasterize_triangle_simd(const triangle_data &triangle, const screen_tile &tile,
+                                        float *depth_buffer, int width, F &&shade_fragment)
+    {
+        int x_start, x_end, y_start, y_end;
+        if (!triangle_tile_bounds(triangle, tile, x_start, x_end, y_start, y_end))
+            return;
+
+        const int x_begin = tile.min_x + ((x_start - tile.min_x) / simd::WIDTH) * simd::WIDTH;
+
+        // Pixel centers relative to the plane origin
+        const simd_triangle_setup setup(triangle);
+        const simd::float_v px = simd::add(simd::set1(static_cast<float>(x_begin) - triangle.minX), simd::add(simd::lane_offsets(), simd::set1(0.5f)));
+
+        for (int y = y_start; y < y_end; ++y)
+        {
+            const float py = static_cast<float>(y) + 0.5f;
+
+            // Incremental stepping: evaluate once at the row start, then add a * WIDTH per group.
+            // Coverage comes from the exact integer edges, the 1 / depth plane only interpolates.
+            simd_edge_lanes edges(setup, triangle, x_begin, y);
+            simd::float_v inv_depth = simd::add(simd::mul(setup.inv_depth_a, px),
+                                                simd::set1(triangle.inv_depth_plane.b * (py - triangle.minY) + triangle.inv_depth_plane.c));
+
+            for (int x = x_begin; x < x_end; x += simd::WIDTH, edges.step(setup), inv_depth = simd::add(inv_depth, setup.inv_depth_step))
+            {
+                const simd::float_v covered = simd::bit_and(edges.coverage(), lane_range_mask(x, x_start, x_end));
+
+                if (simd::move_mask(covered) == 0)
+                    continue;
+
+                shade_group(covered, inv_depth, x, y, depth_buffer, width, shade_fragment);
+            }
+        }
+    }
+
+    //
+    // Hierarchical Traversal
+    //
+
+    constexpr int RASTER_BLOCK_SIZE = 8;
+
+    // Conservative farthest depth of one screen tile and of each of its blocks.
+    // Depth only ever decreases during a frame, so a stale value is still a valid upper bound.
+    struct hi_z_tile
+    {
+        static constexpr int BLOCKS_PER_ROW = TILE_SIZE / RASTER_BLOCK_SIZE;
+
+        float max_depth = std::numeric_limits<float>::infinity();
+        float block_max_depth[BLOCKS_PER_ROW * BLOCKS_PER_ROW];
+
+        // Blocks past the screen edge are set to 0 so they never hold the tile maximum up
+        void clear(const screen_tile &tile)
+        {
+            for (int by = 0; by < BLOCKS_PER_ROW; ++by)
+            {
+                for (int bx = 0; bx < BLOCKS_PER_ROW; ++bx)
+                {
+                    const bool on_screen = tile.min_x + bx * RASTER_BLOCK_SIZE < tile.max_x &&
+                                           tile.min_y + by * RASTER_BLOCK_SIZE < tile.max_y;
+                    block_max_depth[by * BLOCKS_PER_ROW + bx] = on_screen ? std::numeric_limits<float>::infinity() : 0.0f;
+                }
+            }
+            max_depth = std::numeric_limits<float>::infinity();
+        }
+
+        void update_block(const screen_tile &tile, int block_x, int block_y, const float *depth_buffer, int width)
+        {
+            const int x_end = math::min(block_x + RASTER_BLOCK_SIZE, tile.max_x);
+            const int y_end = math::min(block_y + RASTER_BLOCK_SIZE, tile.max_y);
+
+            float block_max = 0.0f;
+            if (x_end - block_x == RASTER_BLOCK_SIZE)
+            {
+                simd::float_v lanes_max = simd::set1(0.0f);
+                for (int y = block_y; y < y_end; ++y)
+                {
+                    const float *row = depth_buffer + y * width + block_x;
+                    for (int x = 0; x < RASTER_BLOCK_SIZE; x += simd::WIDTH)
+                        lanes_max = simd::max(lanes_max, simd::load(row + x));
+                }
+                block_max = simd::reduce_max(lanes_max);
+            }
+            else
+            {
+                for (int y = block_y; y < y_end; ++y)
+                {
+                    const float *row = depth_buffer + y * width;
+                    for (int x = block_x; x < x_end; ++x)
+                        block_max = math::max(block_max, row[x]);
+                }
+            }
+
+            block_max_depth[((block_y - tile.min_y) / RASTER_BLOCK_SIZE) * BLOCKS_PER_ROW + (block_x - tile.min_x) / RASTER_BLOCK_SIZE] = block_max;
+        }
+
+        void update_tile()
+        {
+            float tile_max = 0.0f;
+            for (float block_max : block_max_depth)
+                tile_max = math::max(tile_max, block_max);
+            max_depth = tile_max;
+        }
+    };
+
+    // Exact range of an edge function over the pixel centers of a block starting at pixel (x, y)
+    inline void edge_block_range(const edge_equation &edge, int x, int y, std::int64_t &out_min, std::int64_t &out_max)
+    {
+        constexpr std::int64_t extent = (RASTER_BLOCK_SIZE - 1) * SUBPIXEL_SCALE;
+        const std::int64_t corner = edge.evaluate(pixel_center_fixed(x), pixel_center_fixed(y));
+        const std::int64_t dx = edge.a * extent;
+        const std::int64_t dy = edge.b * extent;
+        out_min = corner + math::min<std::int64_t>(dx, 0) + math::min<std::int64_t>(dy, 0);
+        out_max = corner + math::max<std::int64_t>(dx, 0) + math::max<std::int64_t>(dy, 0);
+    }
+
+    // Range of a plane equation over the pixel centers of a block starting at (x, y), relative to the plane origin
+    inline void plane_block_range(const plane_equation &plane, float x, float y, float &out_min, float &out_max)
+    {
+        constexpr float extent = static_cast<float>(RASTER_BLOCK_SIZE - 1);
+        const float corner = plane.evaluate(x + 0.5f, y + 0.5f);
+        const float dx = plane.a * extent;
+        const float dy = plane.b * extent;
+        out_min = corner + math::min(dx, 0.0f) + math::min(dy, 0.0f);
+        out_max = corner + math::max(dx, 0.0f) + math::max(dy, 0.0f);
+    }
+
+    // Walks the triangle in RASTER_BLOCK_SIZE blocks. Blocks outside any edge are skipped, blocks inside
+    // all three edges run without a coverage test, and only the blocks an edge crosses are tested per pixel.
+    // The hi-z tile rejects the whole triangle or single blocks whose nearest depth is behind everything
+    // already drawn there, and is refreshed for every block that had depth written.
+    template <typename F>
+    inline void rasterize_triangle_hierarchical(const triangle_data &triangle, const screen_tile &tile,
+                                                float *depth_buffer, int width, hi_z_tile &hi_z,
+                                                frame_stats &stats, F &&shade_fragment)
+    {
+        int x_start, x_end, y_start, y_end;
+        if (!triangle_tile_bounds(triangle, tile, x_start, x_end, y_start, y_end))
+            return;
+
+        // The nearest point of a triangle is one of its vertices
+        const float max_inv_depth = math::max(math::max(triangle.inv_depth.x, triangle.inv_depth.y), triangle.inv_depth.z);
+        if (1.0f / max_inv_depth >= hi_z.max_depth)
+        {
+            ++stats.triangles_occluded;
+            return;
+        }
+
+        const int block_x_begin = tile.min_x + ((x_start - tile.min_x) / RASTER_BLOCK_SIZE) * RASTER_BLOCK_SIZE;
+        const int block_y_begin = tile.min_y + ((y_start - tile.min_y) / RASTER_BLOCK_SIZE) * RASTER_BLOCK_SIZE;
+
+        const simd_triangle_setup setup(triangle);
+        const simd::float_v lane_center = simd::add(simd::lane_offsets(), simd::set1(0.5f));
+
+        bool hi_z_dirty = false;
+
+        for (int block_y = block_y_begin; block_y < y_end; block_y += RASTER_BLOCK_SIZE)
+        {
+            for (int block_x = block_x_begin; block_x < x_end; block_x += RASTER_BLOCK_SIZE)
+            {
+                std::int64_t min0, max0, min1, max1, min2, max2;
+                edge_block_range(triangle.edge0, block_x, block_y, min0, max0);
+                edge_block_range(triangle.edge1, block_x, block_y, min1, max1);
+                edge_block_range(triangle.edge2, block_x, block_y, min2, max2);
+
+                if (max0 < 0 || max1 < 0 || max2 < 0)
+                {
+                    ++stats.blocks_rejected;
+                    continue;
+                }
+
+                // Nearest depth of the triangle over this block, the plane can overshoot past the vertices
+                float min_inv_depth, block_inv_depth;
+                plane_block_range(triangle.inv_depth_plane, static_cast<float>(block_x) - triangle.minX, static_cast<float>(block_y) - triangle.minY,
+                                  min_inv_depth, block_inv_depth);
+                const int block_index = ((block_y - tile.min_y) / RASTER_BLOCK_SIZE) * hi_z_tile::BLOCKS_PER_ROW +
+                                        (block_x - tile.min_x) / RASTER_BLOCK_SIZE;
+                if (1.0f / math::min(block_inv_depth, max_inv_depth) >= hi_z.block_max_depth[block_index])
+                {
+                    ++stats.blocks_occluded;
+                    continue;
+                }
+
+                const bool fully_covered = min0 >= 0 && min1 >= 0 && min2 >= 0;
+                if (fully_covered)
+                    ++stats.blocks_accepted;
+                else
+                    ++stats.blocks_partial;
+
+                const int row_begin = math::max(block_y, y_start);
+                const int row_end = math::min(block_y + RASTER_BLOCK_SIZE, y_end);
+                const int column_end = math::min(block_x + RASTER_BLOCK_SIZE, x_end);
+                const simd::float_v px = simd::add(simd::set1(static_cast<float>(block_x) - triangle.minX), lane_center);
+
+                bool depth_written = false;
+
+                for (int y = row_begin; y < row_end; ++y)
+                {
+                    const float py = static_cast<float>(y) + 0.5f;
+
+                    simd_edge_lanes edges(setup, triangle, block_x, y);
+                    simd::float_v inv_depth = simd::add(simd::mul(setup.inv_depth_a, px),
+                                                        simd::set1(triangle.inv_depth_plane.b * (py - triangle.minY) + triangle.inv_depth_plane.c));
+
+                    for (int x = block_x; x < column_end; x += simd::WIDTH, edges.step(setup), inv_depth = simd::add(inv_depth, setup.inv_depth_step))
+                    {
+                        simd::float_v covered = lane_range_mask(x, x_start, column_end);
+
+                        if (!fully_covered)
+                        {
+                            covered = simd::bit_and(covered, edges.coverage());
+
+                            if (simd::move_mask(covered) == 0)
+                                continue;
+                        }
+
+                        depth_written |= shade_group(covered, inv_depth, x, y, depth_buffer, width, shade_fragment);
+                    }
+                }
+
+                if (depth_written)
+                {
+                    hi_z.update_block(tile, block_x, block_y, depth_buffer, width);
+                    hi_z_dirty = true;
+                }
+            }
+        }
+
+        if (hi_z_dirty)
+            hi_z.update_tile();
+    }
+}
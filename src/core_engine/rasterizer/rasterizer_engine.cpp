@@ -1,55 +1,55 @@
-#include <thread>
-#include <atomic>
-
 #include "rasterizer_engine.hpp"
+
+#include <algorithm>
+
 #include "helper/obj_loader.hpp"
+#include "rasterizer/allocation_counter.hpp"
 
 namespace rasterizer
 {
-
     void rasterizer_engine::pre_renders()
     {
+        m_frame_allocation_start = heap_allocation_count();
+
         clear_buffers();
+        m_frame_stats.reset();
+        m_draws.clear();
+        m_draw_passes.clear();
 
         m_camera.update_camera_vectors();
         m_camera.move_camera(m_app->get_delta_time());
+        m_frustum = make_frustum(m_camera, m_screen.x / m_screen.y);
+        cull_models();
     }
 
-    // TODO -> Fix this function to do proper frustum culling
-    bool rasterizer_engine::is_model_visible(const model &m, const camera &cam)
+    void rasterizer_engine::post_renders()
     {
-        // Compute bounding box in model space
-        if (m.m_mesh.positions.empty())
-            return false;
-
-        rasterizer::vector3f min_bound = m.m_mesh.positions[0];
-        rasterizer::vector3f max_bound = m.m_mesh.positions[0];
-        for (const auto &v : m.m_mesh.positions)
+        if (!m_draws.empty())
         {
-            min_bound.x = math::min(min_bound.x, v.x);
-            min_bound.y = math::min(min_bound.y, v.y);
-            min_bound.z = math::min(min_bound.z, v.z);
-            max_bound.x = math::max(max_bound.x, v.x);
-            max_bound.y = math::max(max_bound.y, v.y);
-            max_bound.z = math::max(max_bound.z, v.z);
+            draw_queued_models();
+
+            if (m_shading_mode == shading_mode::visibility_buffer)
+                resolve_visibility_buffer();
         }
 
-        // Transform bounds to world space (apply model transform)
-        rasterizer::vector3f min_world = transform_point(min_bound, m.model_transform);
-        rasterizer::vector3f max_world = transform_point(max_bound, m.model_transform);
+        m_frame_stats.heap_allocations = heap_allocation_count() - m_frame_allocation_start;
+    }
 
-        // Simple near/far plane check (assuming camera looks along -Z)
-        float near_plane = 0.01f;
-        float far_plane = 1000.0f;
+    void rasterizer_engine::cull_models()
+    {
+        // Rebuild when models were added or removed, otherwise only refit the ones that moved
+        if (m_scene_bvh.source_count() != m_models.size())
+            m_scene_bvh.build(m_models);
+        else
+            m_scene_bvh.refit(m_models);
 
-        if (max_world.z < cam.camera_transform.position.z + near_plane)
-            return false;
-        if (min_world.z > cam.camera_transform.position.z + far_plane)
-            return false;
+        m_visible_models.clear();
+        m_scene_bvh.query(m_frustum, m_visible_models);
 
-        // Optionally, add checks for X/Y screen bounds here
+        // Back to submission order, so the draw order does not depend on the tree layout
+        std::sort(m_visible_models.begin(), m_visible_models.end());
 
-        return true;
+        m_frame_stats.models_culled += m_models.size() - m_visible_models.size();
     }
 
     //
@@ -82,130 +82,145 @@ namespace rasterizer
     // Private Methods
     //
 
-    void rasterizer_engine::clear_buffers()
-    {
-        if (m_color_buffer)
-            std::fill(m_color_buffer, m_color_buffer + (m_width * m_height), to_uint32(m_clear_color));
-
-        if (!m_depth_buffer.empty())
-            std::fill(m_depth_buffer.begin(), m_depth_buffer.end(), std::numeric_limits<float>::infinity());
-    }
-
-    void rasterizer_engine::draw_to_pixel_tiled(const model &model,
-                                                std::vector<float> &depth_buffer,
-                                                std::uint32_t *pixels)
+    void rasterizer_engine::build_tiles()
     {
-
-        int num_threads = std::thread::hardware_concurrency();
-        if (num_threads == 0)
-        {
-            num_threads = 4;
-        }
-
-        constexpr int TILE_SIZE = 64;
-
-        std::vector<screen_tile> work_queue;
+        m_tiles.clear();
 
         for (int y = 0; y < m_height; y += TILE_SIZE)
         {
             for (int x = 0; x < m_width; x += TILE_SIZE)
             {
-                work_queue.emplace_back(
+                m_tiles.emplace_back(
                     x, y,
                     math::min(x + TILE_SIZE, m_width),
                     math::min(y + TILE_SIZE, m_height));
             }
         }
 
-        std::atomic<int> work_index = 0;
-        const int total_work_items = static_cast<int>(work_queue.size());
+        m_binner.resize(m_width, m_height, TILE_SIZE);
+        m_tile_stats.resize(m_tiles.size());
+        m_hi_z.resize(m_tiles.size());
+    }
+
+    void rasterizer_engine::register_builtin_shader_kernels()
+    {
+        register_shader_kernel<texture_shader>();
+        register_shader_kernel<lit_shader>();
+        register_shader_kernel<lit_texture>();
+        register_shader_kernel<normal_visual_shader>();
+    }
 
-        std::vector<std::thread> threads;
-        for (int t = 0; t < num_threads; ++t)
+    tile_pass_fn rasterizer_engine::select_tile_pass(const model &model) const
+    {
+        if (model.shader_ptr)
         {
-            threads.emplace_back([&]()
-                                 {
-            while (true)
-            {
-                int index = work_index.fetch_add(1);
+            auto it = m_tile_passes.find(std::type_index(typeid(*model.shader_ptr)));
+            if (it != m_tile_passes.end())
+                return it->second;
+        }
 
-                if (index >= total_work_items)
-                {
-                    break; // No more work
-                }
+        return &forward_tile_pass<shader>;
+    }
 
-                const screen_tile &tile = work_queue[index];
+    void rasterizer_engine::clear_buffers()
+    {
+        const std::uint32_t clear_color = to_uint32(m_clear_color);
+        const int row_count = (m_height + TILE_SIZE - 1) / TILE_SIZE;
 
-                for (unsigned int i = 0; i < model.triangles_data.size(); ++i)
-                {
-                    const auto &triangle = model.triangles_data[i];
+        // Clear one band of tile rows per job
+        m_job_system.parallel_for(row_count, [&](int row)
+                                  {
+            const int tiles_per_row = static_cast<int>(m_tiles.size()) / row_count;
+            for (int t = row * tiles_per_row; t < (row + 1) * tiles_per_row; ++t)
+                m_hi_z[t].clear(m_tiles[t]);
 
-                    if (triangle.inv_depth.z <= 0 || triangle.inv_depth.y <= 0 || triangle.inv_depth.x <= 0)
-                        continue;
+            const int begin = row * TILE_SIZE * m_width;
+            const int end = math::min(row * TILE_SIZE + TILE_SIZE, m_height) * m_width;
 
-                    if (triangle.maxX < tile.min_x || triangle.minX >= tile.max_x ||
-                        triangle.maxY < tile.min_y || triangle.minY >= tile.max_y)
-                    {
-                        continue;
-                    }
-
-                    int x_start = math::max(tile.min_x, static_cast<int>(math::floor(triangle.minX)));
-                    int x_end = math::min(tile.max_x, static_cast<int>(math::ceil(triangle.maxX)));
-                    int y_start = math::max(tile.min_y, static_cast<int>(math::floor(triangle.minY)));
-                    int y_end = math::min(tile.max_y, static_cast<int>(math::ceil(triangle.maxY)));
-
-                    for (int y = y_start; y < y_end; ++y)
-                    {
-                        for (int x = x_start; x < x_end; ++x)
-                        {
-                            float px = static_cast<float>(x) + 0.5f;
-                            float py = static_cast<float>(y) + 0.5f;
-                            rasterizer::vector3f weight{0.0f, 0.0f, 0.0f};
-
-                            if (!rasterizer::point_in_triangle(triangle.p0, triangle.p1, triangle.p2, px, py, weight))
-                                continue;
-
-                            float interpolated_z = 1.0f / (triangle.inv_depth.x * weight.x +
-                                                           triangle.inv_depth.y * weight.y +
-                                                           triangle.inv_depth.z * weight.z);
-                            int idx = y * m_width + x;
-
-                            if (interpolated_z >= depth_buffer[idx])
-                                continue;
-
-                            depth_buffer[idx] = interpolated_z;
-
-                            vector3f position{
-                                    triangle.p0.x * weight.x + triangle.p1.x * weight.y + triangle.p2.x * weight.z,
-                                    triangle.p0.y * weight.x + triangle.p1.y * weight.y + triangle.p2.y * weight.z,
-                                    interpolated_z
-                            };
-                            vector2f tex_coord = (triangle.tx * weight.x + triangle.ty * weight.y + triangle.tz * weight.z) * interpolated_z;
-                            vector3f normal = (triangle.nx * weight.x + triangle.ny * weight.y + triangle.nz * weight.z) * interpolated_z;
-
-                            if (model.shader_ptr)
-                            {
-                                
-                                pixels[idx] = rasterizer::to_uint32(model.shader_ptr->shade(
-                                    position, normal, tex_coord));
-                            }
-                            else
-                            {
-                                pixels[idx] = rasterizer::to_uint32(vector3f{1.0f, 0.0f, 1.0f});
-                            }
-                        }
-                    }
-                }
-            } });
-        }
+            if (m_color_buffer)
+                std::fill(m_color_buffer + begin, m_color_buffer + end, clear_color);
+
+            if (!m_depth_buffer.empty())
+                std::fill(m_depth_buffer.begin() + begin, m_depth_buffer.begin() + end, std::numeric_limits<float>::infinity()); });
+    }
 
-        for (auto &th : threads)
+    void rasterizer_engine::queue_draw(const model &model)
+    {
+        // Pick the kernel once per draw, not per tile or pixel
+        m_draws.push_back(&model);
+        m_draw_passes.push_back(select_tile_pass(model));
+    }
+
+    void rasterizer_engine::draw_queued_models()
+    {
+        m_binner.bin(m_draws, m_job_system);
+
+        const bool deferred = m_shading_mode == shading_mode::visibility_buffer;
+
+        // Each tile is visited once per frame and draws every model over it in submission order
+        m_job_system.parallel_for(static_cast<int>(m_tiles.size()), [&](int index)
+                                  {
+            tile_pass_context ctx{
+                &m_tiles[index], nullptr, nullptr, 0, nullptr, nullptr, m_raster_mode,
+                m_depth_buffer.data(), m_width, &m_hi_z[index], &m_tile_stats[index].stats,
+                m_color_buffer, nullptr,
+                m_visibility_buffer.data(), 0};
+
+            m_binner.for_each_draw_run(index, [&](std::uint32_t draw_index, const std::uint32_t *first_entry, const std::uint32_t *last_entry)
+                                       {
+                const model &model = *m_draws[draw_index];
+                ctx.first_entry = first_entry;
+                ctx.last_entry = last_entry;
+                ctx.triangle_offset = m_binner.draw_offset(draw_index);
+                ctx.triangles = &model.triangles_data;
+                ctx.attributes = &model.triangle_attributes_data;
+                ctx.shader_ptr = model.shader_ptr;
+                ctx.draw_index = draw_index;
+
+                const tile_pass_fn tile_pass = deferred ? &visibility_tile_pass : m_draw_passes[draw_index];
+                tile_pass(ctx); }); });
+
+        // Each tile only touched its own counters, fold them in once the pass is done
+        for (auto &tile_stats : m_tile_stats)
         {
-            if (th.joinable())
-                th.join();
+            m_frame_stats += tile_stats.stats;
+            tile_stats.stats.reset();
         }
     }
 
+    // Shade every covered pixel exactly once from the triangle that won the depth test
+    void rasterizer_engine::resolve_visibility_buffer()
+    {
+        m_job_system.parallel_for(static_cast<int>(m_tiles.size()), [&](int index)
+                                  {
+            const screen_tile &tile = m_tiles[index];
+            fragment_batcher<> batcher(m_color_buffer);
+
+            for (int y = tile.min_y; y < tile.max_y; ++y)
+            {
+                for (int x = tile.min_x; x < tile.max_x; ++x)
+                {
+                    const int idx = y * m_width + x;
+                    const float depth = m_depth_buffer[idx];
+                    if (depth == std::numeric_limits<float>::infinity())
+                        continue;
+
+                    const visibility_sample sample = m_visibility_buffer[idx];
+                    const model &model = *m_draws[sample.draw_index];
+                    const triangle_data &triangle = model.triangles_data[sample.triangle_index];
+                    const triangle_attributes &attributes = model.triangle_attributes_data[sample.triangle_index];
+
+                    const float px = static_cast<float>(x) + 0.5f;
+                    const float py = static_cast<float>(y) + 0.5f;
+
+                    batcher.set_shader(model.shader_ptr);
+                    emit_fragment<varying_all>(batcher, triangle, attributes, idx, px, py, depth);
+                }
+            }
+
+            batcher.flush(); });
+    }
+
     //
     // Derived Class Functions
     //
@@ -234,21 +249,23 @@ namespace rasterizer
             loaded_model2.indices,
             floor_transform,
             m_shaders[0].get());
+
+        // Closed mesh, back faces always lose the depth test
+        m_models.back().face_culling = cull_mode::back;
     }
 
     void main_engine::render_models()
     {
-        for (auto &model : m_models)
+        for (std::uint32_t model_index : m_visible_models)
         {
-            if (!is_model_visible(model, m_camera))
-                continue;
+            model &model = m_models[model_index];
 
             // Process model
-            process_model(model, m_camera, m_screen);
+            process_model(model, m_camera, m_frustum, m_screen, m_job_system, m_frame_stats);
 
-            model.fill_triangle_data();
+            m_frame_stats.triangles_culled += model.fill_triangle_data(m_job_system);
 
-            draw_to_pixel_tiled(model, m_depth_buffer, m_color_buffer);
+            queue_draw(model);
         }
     }
 
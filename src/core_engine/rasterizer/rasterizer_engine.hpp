@@ -2,15 +2,30 @@
 
 #include <limits>
 #include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 #include "application/application.hpp"
+#include "frame_stats.hpp"
+#include "job_system.hpp"
+#include "raster_kernel.hpp"
+#include "scene_bvh.hpp"
+#include "tile_binner.hpp"
+#include "tile_pass.hpp"
 #include "types.hpp"
 #include "model.hpp"
 #include "types_math.hpp"
 
 namespace rasterizer
 {
+    enum class shading_mode
+    {
+        forward,          // shade every fragment that passes the depth test when it is drawn
+        visibility_buffer // draw depth and triangle ids only, shade each visible pixel once in post_renders
+    };
+
     class rasterizer_engine
     {
     public:
@@ -18,24 +33,37 @@ namespace rasterizer
         int m_height;
         vector2f m_screen;
         color4ub m_clear_color = {0, 0, 0, 255};
+        raster_mode m_raster_mode = raster_mode::hierarchical;
+        shading_mode m_shading_mode = shading_mode::forward;
 
-        rasterizer_engine(int width, int height, application::application &app)
+        // thread_count == 0 uses one worker per hardware thread
+        rasterizer_engine(int width, int height, application::application &app, unsigned int thread_count = 0)
             : m_width(width),
               m_height(height),
               m_screen(static_cast<float>(width), static_cast<float>(height)),
-              m_app(&app)
+              m_app(&app),
+              m_job_system(thread_count)
         {
             m_camera.camera_transform.position = {0, 0, -5.0f};
             m_color_buffer = static_cast<std::uint32_t *>(m_app->m_draw_surface->pixels);
             m_depth_buffer.resize(m_width * m_height, std::numeric_limits<float>::infinity());
+            m_visibility_buffer.resize(m_width * m_height);
+            build_tiles();
+            register_builtin_shader_kernels();
         }
 
+        virtual ~rasterizer_engine() = default;
+
         virtual void setup_models() = 0;
 
         void pre_renders();
 
         virtual void render_models() = 0;
 
+        void post_renders();
+
+        const frame_stats &get_frame_stats() const { return m_frame_stats; }
+
         //
         // Camera Functions
         //
@@ -46,20 +74,59 @@ namespace rasterizer
 
     protected:
         application::application *m_app = nullptr;
+        job_system m_job_system;
+        std::vector<screen_tile> m_tiles;
+        tile_binner m_binner;
+        frame_stats m_frame_stats;
+        std::uint64_t m_frame_allocation_start = 0;
+        std::vector<padded_frame_stats> m_tile_stats;
+        std::vector<hi_z_tile> m_hi_z;
         std::uint32_t *m_color_buffer = nullptr;
         std::vector<float> m_depth_buffer;
 
+        // Only read where the depth buffer was written this frame, so it never needs clearing
+        std::vector<visibility_sample> m_visibility_buffer;
+
+        // Models queued this frame in draw order with their forward tile pass, visibility samples index into it
+        std::vector<const model *> m_draws;
+        std::vector<tile_pass_fn> m_draw_passes;
+
+        // Forward tile pass specialized per concrete shader type
+        std::unordered_map<std::type_index, tile_pass_fn> m_tile_passes;
+
         rasterizer::camera m_camera;
+        frustum m_frustum; // Rebuilt from m_camera in pre_renders
         std::vector<rasterizer::model> m_models;
+        scene_bvh m_scene_bvh;
+        std::vector<std::uint32_t> m_visible_models; // Indices into m_models, ascending, filled in pre_renders
         std::vector<std::unique_ptr<rasterizer::shader>> m_shaders;
 
+        void build_tiles();
+
+        // Shader types without a registered kernel fall back to the generic, virtually dispatched one
+        template <typename ShaderT>
+        void register_shader_kernel()
+        {
+            m_tile_passes[std::type_index(typeid(ShaderT))] = &forward_tile_pass<ShaderT>;
+        }
+
+        void register_builtin_shader_kernels();
+
+        tile_pass_fn select_tile_pass(const model &model) const;
+
         void clear_buffers();
 
-        void draw_to_pixel_tiled(const model &model,
-                                 std::vector<float> &depth_buffer,
-                                 std::uint32_t *pixels);
+        // Queues a model whose triangles fill_triangle_data set up. They are read from the model by the
+        // frame's single raster pass in post_renders, so a model is queued at most once per frame.
+        void queue_draw(const model &model);
 
-        bool is_model_visible(const model &m, const camera &cam);
+        // Bins the triangles of every queued model, then runs one tile pass over the whole frame
+        void draw_queued_models();
+
+        void resolve_visibility_buffer();
+
+        // Fills m_visible_models from m_scene_bvh and m_frustum, counts culled models
+        void cull_models();
     };
 
     //
@@ -82,19 +149,4 @@ namespace rasterizer
 
     void center_model(helper::model_data &model_data);
 
-    inline rasterizer::vector3f transform_point(const rasterizer::vector3f &point, const rasterizer::transform &t)
-    {
-        rasterizer::vector3f scaled{
-            point.x * t.scale.x,
-            point.y * t.scale.y,
-            point.z * t.scale.z};
-
-        rasterizer::vector3f world{
-            scaled.x + t.position.x,
-            scaled.y + t.position.y,
-            scaled.z + t.position.z};
-
-        return world;
-    }
-
 }
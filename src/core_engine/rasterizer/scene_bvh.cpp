@@ -0,0 +1,179 @@
+#include "rasterizer/scene_bvh.hpp"
+
+#include <algorithm>
+
+namespace rasterizer
+{
+    static void grow(bounding_box &box, const bounding_box &other)
+    {
+        box.min.x = math::min(box.min.x, other.min.x);
+        box.min.y = math::min(box.min.y, other.min.y);
+        box.min.z = math::min(box.min.z, other.min.z);
+        box.max.x = math::max(box.max.x, other.max.x);
+        box.max.y = math::max(box.max.y, other.max.y);
+        box.max.z = math::max(box.max.z, other.max.z);
+    }
+
+    static float axis_value(const vector3f &v, int axis)
+    {
+        return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+    }
+
+    void scene_bvh::build(std::vector<model> &models)
+    {
+        const std::size_t model_count = models.size();
+        m_source_count = model_count;
+        m_nodes.clear();
+        m_model_indices.clear();
+        m_model_leaf.assign(model_count, INVALID_INDEX);
+        m_model_boxes.resize(model_count);
+        m_model_spheres.resize(model_count);
+        m_model_versions.resize(model_count);
+        m_moved_models.clear();
+
+        for (std::size_t i = 0; i < model_count; ++i)
+        {
+            models[i].track_moves(&m_moved_models, static_cast<std::uint32_t>(i));
+            if (models[i].m_mesh.positions.empty())
+                continue;
+
+            const model_bounds &bounds = models[i].get_world_bounds();
+            m_model_boxes[i] = bounds.box;
+            m_model_spheres[i] = bounds.sphere;
+            m_model_versions[i] = models[i].get_transform().get_matrix_version();
+            m_model_indices.push_back(static_cast<std::uint32_t>(i));
+        }
+
+        if (m_model_indices.empty())
+            return;
+
+        // A binary tree with at least one model per leaf never needs more nodes than this
+        m_nodes.reserve(m_model_indices.size() * 2);
+        m_nodes.emplace_back();
+        build_node(0, 0, static_cast<std::uint32_t>(m_model_indices.size()));
+    }
+
+    void scene_bvh::refit(std::vector<model> &models)
+    {
+        // Only moved models are visited, the version check skips repeats and moves back to the same placement.
+        // A new mesh keeps the version but leaves the world bounds to be rebuilt.
+        for (std::uint32_t model_index : m_moved_models)
+        {
+            const std::uint32_t leaf = m_model_leaf[model_index];
+            if (leaf == INVALID_INDEX)
+                continue;
+
+            const std::uint64_t version = models[model_index].get_transform().get_matrix_version();
+            if (version == m_model_versions[model_index] && !models[model_index].update_world_bounds())
+                continue;
+
+            const model_bounds &bounds = models[model_index].get_world_bounds();
+            m_model_boxes[model_index] = bounds.box;
+            m_model_spheres[model_index] = bounds.sphere;
+            m_model_versions[model_index] = version;
+
+            fit_leaf(m_nodes[leaf]);
+            for (std::uint32_t parent = m_nodes[leaf].parent; parent != INVALID_INDEX; parent = m_nodes[parent].parent)
+            {
+                node &inner = m_nodes[parent];
+                inner.box = m_nodes[inner.first].box;
+                grow(inner.box, m_nodes[inner.first + 1].box);
+            }
+        }
+        m_moved_models.clear();
+    }
+
+    void scene_bvh::query(const frustum &view, std::vector<std::uint32_t> &visible) const
+    {
+        if (!m_nodes.empty())
+            query_node(0, view, frustum::ALL_PLANES, visible);
+    }
+
+    //
+    // Private Methods
+    //
+
+    void scene_bvh::build_node(std::uint32_t node_index, std::uint32_t first, std::uint32_t count)
+    {
+        if (count <= MAX_LEAF_MODELS)
+        {
+            m_nodes[node_index].first = first;
+            m_nodes[node_index].count = count;
+            for (std::uint32_t i = first; i < first + count; ++i)
+                m_model_leaf[m_model_indices[i]] = node_index;
+
+            fit_leaf(m_nodes[node_index]);
+            return;
+        }
+
+        // Median split along the axis the box centers spread the most on
+        auto center = [&](std::uint32_t model_index)
+        {
+            const bounding_box &box = m_model_boxes[model_index];
+            return (box.min + box.max) * 0.5f;
+        };
+
+        bounding_box centers{center(m_model_indices[first]), center(m_model_indices[first])};
+        for (std::uint32_t i = first + 1; i < first + count; ++i)
+        {
+            vector3f c = center(m_model_indices[i]);
+            grow(centers, bounding_box{c, c});
+        }
+
+        vector3f extent = centers.max - centers.min;
+        int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+        auto begin = m_model_indices.begin() + first;
+        std::nth_element(begin, begin + count / 2, begin + count,
+                         [&](std::uint32_t a, std::uint32_t b)
+                         { return axis_value(center(a), axis) < axis_value(center(b), axis); });
+
+        // Children sit next to each other, nodes are only referenced by index since the vector grows
+        const std::uint32_t left = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+        m_nodes.emplace_back();
+        m_nodes[left].parent = node_index;
+        m_nodes[left + 1].parent = node_index;
+        m_nodes[node_index].first = left;
+        m_nodes[node_index].count = 0;
+
+        build_node(left, first, count / 2);
+        build_node(left + 1, first + count / 2, count - count / 2);
+
+        m_nodes[node_index].box = m_nodes[left].box;
+        grow(m_nodes[node_index].box, m_nodes[left + 1].box);
+    }
+
+    void scene_bvh::fit_leaf(node &leaf) const
+    {
+        leaf.box = m_model_boxes[m_model_indices[leaf.first]];
+        for (std::uint32_t i = leaf.first + 1; i < leaf.first + leaf.count; ++i)
+            grow(leaf.box, m_model_boxes[m_model_indices[i]]);
+    }
+
+    void scene_bvh::query_node(std::uint32_t node_index, const frustum &view, std::uint32_t plane_mask, std::vector<std::uint32_t> &visible) const
+    {
+        const node &current = m_nodes[node_index];
+        if (!view.intersects(current.box, plane_mask))
+            return;
+
+        if (current.count == 0)
+        {
+            query_node(current.first, view, plane_mask, visible);
+            query_node(current.first + 1, view, plane_mask, visible);
+            return;
+        }
+
+        for (std::uint32_t i = current.first; i < current.first + current.count; ++i)
+        {
+            const std::uint32_t model_index = m_model_indices[i];
+
+            // Sphere first since it is the cheaper test, the box catches long thin models it misses
+            std::uint32_t model_mask = plane_mask;
+            if (plane_mask == 0 ||
+                (view.intersects(m_model_spheres[model_index], model_mask) &&
+                 view.intersects(m_model_boxes[model_index], model_mask)))
+                visible.push_back(model_index);
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rasterizer/model.hpp"
+
+namespace rasterizer
+{
+    // Bounding volume hierarchy over the world bounds of every model in the scene.
+    // Frustum queries skip whole subtrees outside the view and stop testing planes a subtree
+    // is fully inside of, so their cost follows the visible part of the scene.
+    // Models report moves and new meshes through model::set_transform and set_mesh and are refit without
+    // rebuilding the tree. Models that had an empty mesh when it was built stay out until the next build.
+    class scene_bvh
+    {
+    public:
+        // Builds the tree from scratch and starts tracking moves of every model, models with an empty mesh are left out
+        void build(std::vector<model> &models);
+
+        // Updates the bounds of the models moved since the last refit and their ancestors, the topology stays the same.
+        // Needs the same model list the tree was built from, at the same addresses.
+        void refit(std::vector<model> &models);
+
+        // Appends the index of every model intersecting the frustum, in tree order
+        void query(const frustum &view, std::vector<std::uint32_t> &visible) const;
+
+        // Size of the model list the tree was built from
+        std::size_t source_count() const { return m_source_count; }
+
+    private:
+        static constexpr std::uint32_t MAX_LEAF_MODELS = 4;
+        static constexpr std::uint32_t INVALID_INDEX = ~std::uint32_t{0};
+
+        // Leaves own count > 0 entries of m_model_indices starting at first.
+        // Inner nodes have count == 0 and their two children at first and first + 1.
+        struct node
+        {
+            bounding_box box;
+            std::uint32_t first = 0;
+            std::uint32_t count = 0;
+            std::uint32_t parent = INVALID_INDEX;
+        };
+
+        std::vector<node> m_nodes;
+        std::vector<std::uint32_t> m_model_indices;
+        std::vector<std::uint32_t> m_model_leaf; // Leaf per source model, INVALID_INDEX when left out
+        std::vector<bounding_box> m_model_boxes;
+        std::vector<bounding_sphere> m_model_spheres;
+        std::vector<std::uint64_t> m_model_versions; // Transform matrix version the bounds were taken at
+        std::vector<std::uint32_t> m_moved_models;   // Filled by model::set_transform, may repeat a model
+        std::size_t m_source_count = 0;
+
+        void build_node(std::uint32_t node_index, std::uint32_t first, std::uint32_t count);
+
+        void fit_leaf(node &leaf) const;
+
+        void query_node(std::uint32_t node_index, const frustum &view, std::uint32_t plane_mask, std::vector<std::uint32_t> &visible) const;
+    };
+}
@@ -0,0 +1,81 @@
+#include "rasterizer/tile_binner.hpp"
+
+namespace rasterizer
+{
+    void tile_binner::resize(int width, int height, int tile_size)
+    {
+        m_width = width;
+        m_height = height;
+        m_tile_size = tile_size;
+        m_tiles_x = (width + tile_size - 1) / tile_size;
+        m_tiles_y = (height + tile_size - 1) / tile_size;
+        m_tile_count = m_tiles_x * m_tiles_y;
+        m_chunk_count = 0;
+        m_bins.clear();
+    }
+
+    void tile_binner::bin(const std::vector<const model *> &draws, job_system &jobs)
+    {
+        m_draw_offsets.resize(draws.size() + 1);
+        m_draw_offsets[0] = 0;
+        for (std::size_t draw = 0; draw < draws.size(); ++draw)
+            m_draw_offsets[draw + 1] = m_draw_offsets[draw] + static_cast<std::uint32_t>(draws[draw]->triangles_data.size());
+
+        const int triangle_count = static_cast<int>(m_draw_offsets.back());
+        const int max_chunks = static_cast<int>(jobs.thread_count()) + 1;
+        m_chunk_count = math::clamp((triangle_count + MIN_TRIANGLES_PER_CHUNK - 1) / MIN_TRIANGLES_PER_CHUNK, 1, max_chunks);
+
+        const std::size_t bin_count = static_cast<std::size_t>(m_chunk_count) * m_tile_count;
+        if (m_bins.size() < bin_count)
+            m_bins.resize(bin_count);
+
+        const int chunk_size = (triangle_count + m_chunk_count - 1) / m_chunk_count;
+
+        jobs.parallel_for(m_chunk_count, [&](int chunk)
+                          {
+            const int begin = math::min(chunk * chunk_size, triangle_count);
+            const int end = math::min(begin + chunk_size, triangle_count);
+            bin_chunk(draws, chunk, static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end)); });
+    }
+
+    //
+    // Private Methods
+    //
+
+    void tile_binner::bin_chunk(const std::vector<const model *> &draws, int chunk, std::uint32_t begin, std::uint32_t end)
+    {
+        std::vector<std::uint32_t> *chunk_bins = &m_bins[static_cast<std::size_t>(chunk) * m_tile_count];
+        for (int tile = 0; tile < m_tile_count; ++tile)
+            chunk_bins[tile].clear();
+
+        const float max_x = static_cast<float>(m_width - 1);
+        const float max_y = static_cast<float>(m_height - 1);
+
+        // Walks forward to the draw holding triangle i, stepping over empty draws
+        std::size_t draw = 0;
+        for (std::uint32_t i = begin; i < end; ++i)
+        {
+            while (i >= m_draw_offsets[draw + 1])
+                ++draw;
+            const triangle_data &triangle = draws[draw]->triangles_data[i - m_draw_offsets[draw]];
+
+            if (triangle.inv_depth.z <= 0 || triangle.inv_depth.y <= 0 || triangle.inv_depth.x <= 0)
+                continue;
+
+            // Reject triangles fully off-screen, then clamp before converting so huge coordinates can't overflow
+            if (triangle.maxX < 0.0f || triangle.minX >= m_width || triangle.maxY < 0.0f || triangle.minY >= m_height)
+                continue;
+
+            const int tile_x0 = static_cast<int>(math::max(triangle.minX, 0.0f)) / m_tile_size;
+            const int tile_x1 = static_cast<int>(math::min(triangle.maxX, max_x)) / m_tile_size;
+            const int tile_y0 = static_cast<int>(math::max(triangle.minY, 0.0f)) / m_tile_size;
+            const int tile_y1 = static_cast<int>(math::min(triangle.maxY, max_y)) / m_tile_size;
+
+            for (int ty = tile_y0; ty <= tile_y1; ++ty)
+            {
+                for (int tx = tile_x0; tx <= tile_x1; ++tx)
+                    chunk_bins[ty * m_tiles_x + tx].push_back(i);
+            }
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rasterizer/job_system.hpp"
+#include "rasterizer/model.hpp"
+#include "rasterizer/types.hpp"
+
+namespace rasterizer
+{
+    // Sorts the triangles of every draw in a frame into per-tile index lists, so the tile pass only
+    // visits overlapping triangles. Draws are numbered in submission order and their triangles laid
+    // end to end, an entry is the scene-wide index of a triangle.
+    // Triangles are binned in contiguous chunks, one list per (chunk, tile). Walking the chunks
+    // in order gives back the original submission order without a merge step.
+    class tile_binner
+    {
+    public:
+        void resize(int width, int height, int tile_size);
+
+        void bin(const std::vector<const model *> &draws, job_system &jobs);
+
+        // Scene-wide index of the first triangle of a draw
+        std::uint32_t draw_offset(std::uint32_t draw_index) const { return m_draw_offsets[draw_index]; }
+
+        // Calls fn(draw_index, first, last) for every run of entries from one draw in the tile, in submission order.
+        // A draw split across chunks comes as several consecutive runs.
+        template <typename F>
+        void for_each_draw_run(int tile_index, F &&fn) const
+        {
+            std::uint32_t draw_index = 0;
+            for (int chunk = 0; chunk < m_chunk_count; ++chunk)
+            {
+                const std::vector<std::uint32_t> &bin = m_bins[chunk * m_tile_count + tile_index];
+                const std::uint32_t *entry = bin.data();
+                const std::uint32_t *bin_end = entry + bin.size();
+
+                while (entry != bin_end)
+                {
+                    // Entries only ever increase, so the draw only moves forward
+                    while (*entry >= m_draw_offsets[draw_index + 1])
+                        ++draw_index;
+
+                    const std::uint32_t *run_end = entry;
+                    while (run_end != bin_end && *run_end < m_draw_offsets[draw_index + 1])
+                        ++run_end;
+
+                    fn(draw_index, entry, run_end);
+                    entry = run_end;
+                }
+            }
+        }
+
+    private:
+        static constexpr int MIN_TRIANGLES_PER_CHUNK = 256;
+
+        int m_width = 0;
+        int m_height = 0;
+        int m_tile_size = 1;
+        int m_tiles_x = 0;
+        int m_tiles_y = 0;
+        int m_tile_count = 0;
+        int m_chunk_count = 0;
+
+        // Flattened [chunk][tile], lists are cleared but never shrunk so capacity is reused
+        std::vector<std::vector<std::uint32_t>> m_bins;
+
+        // Draw d owns the scene-wide indices [m_draw_offsets[d], m_draw_offsets[d + 1])
+        std::vector<std::uint32_t> m_draw_offsets;
+
+        void bin_chunk(const std::vector<const model *> &draws, int chunk, std::uint32_t begin, std::uint32_t end);
+    };
+}
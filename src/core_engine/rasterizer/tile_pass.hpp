@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rasterizer/frame_stats.hpp"
+#include "rasterizer/model.hpp"
+#include "rasterizer/raster_kernel.hpp"
+#include "shader/fragment_batcher.hpp"
+#include "shader/shader.hpp"
+
+namespace rasterizer
+{
+    enum class raster_mode
+    {
+        scalar,      // fixed-point edge functions one pixel at a time
+        simd,        // edge functions evaluated simd::WIDTH pixels at a time
+        hierarchical // simd, walked in blocks with trivial reject/accept
+    };
+
+    // What the visibility buffer keeps per pixel, resolved against the frame's draw list
+    struct visibility_sample
+    {
+        std::uint32_t draw_index;
+        std::uint32_t triangle_index;
+    };
+
+    // Everything one tile job needs for one run of a draw's binned triangles
+    struct tile_pass_context
+    {
+        const screen_tile *tile;
+        const std::uint32_t *first_entry; // Scene-wide triangle indices, all from this draw
+        const std::uint32_t *last_entry;
+        std::uint32_t triangle_offset; // Scene-wide index of the draw's first triangle
+        const std::vector<triangle_data> *triangles;
+        const std::vector<triangle_attributes> *attributes;
+        raster_mode mode;
+
+        float *depth_buffer;
+        int width;
+        hi_z_tile *hi_z;
+        frame_stats *stats;
+
+        // Forward shading target
+        std::uint32_t *pixels;
+        const shader *shader_ptr;
+
+        // Visibility buffer target
+        visibility_sample *visibility_buffer;
+        std::uint32_t draw_index;
+    };
+
+    using tile_pass_fn = void (*)(const tile_pass_context &);
+
+    // Interpolate the varyings the shader reads and queue the fragment for shading.
+    // Each one is its plane at the pixel times the depth, one multiply-add pair per component.
+    template <std::uint32_t Varyings, typename ShaderT>
+    inline void emit_fragment(fragment_batcher<ShaderT> &batcher, const triangle_data &triangle, const triangle_attributes &attributes, int idx,
+                              float px, float py, float interpolated_z)
+    {
+        vector2f tex_coord;
+        vector3f normal;
+        texture_gradient tex_gradient;
+
+        // Planes are relative to the bounds corner
+        const float dx = px - triangle.minX;
+        const float dy = py - triangle.minY;
+
+        if constexpr ((Varyings & (varying_tex_coord | varying_tex_gradient)) != 0)
+            tex_coord = vector2f{attributes.tex_u.evaluate(dx, dy), attributes.tex_v.evaluate(dx, dy)} * interpolated_z;
+
+        // tex_coord = T / W with T and W = 1 / z both linear in screen space, so
+        // d(tex_coord)/dx = (dT/dx - tex_coord * dW/dx) * z, the same for y
+        if constexpr ((Varyings & varying_tex_gradient) != 0)
+        {
+            const vector2f dt_dx{attributes.tex_u.a, attributes.tex_v.a};
+            const vector2f dt_dy{attributes.tex_u.b, attributes.tex_v.b};
+            const vector2f du_dx = (dt_dx - tex_coord * triangle.inv_depth_plane.a) * interpolated_z;
+            const vector2f du_dy = (dt_dy - tex_coord * triangle.inv_depth_plane.b) * interpolated_z;
+            tex_gradient = texture_gradient{du_dx.x, du_dx.y, du_dy.x, du_dy.y};
+        }
+
+        if constexpr ((Varyings & varying_normal) != 0)
+            normal = vector3f{attributes.normal_x.evaluate(dx, dy), attributes.normal_y.evaluate(dx, dy), attributes.normal_z.evaluate(dx, dy)} * interpolated_z;
+
+        batcher.add(idx, px, py, interpolated_z, normal, tex_coord, tex_gradient);
+    }
+
+    // Run the selected raster kernel over every triangle of the run.
+    // emit(triangle_index, triangle, pixel_index, x, y, depth) receives each visible fragment.
+    template <typename F>
+    inline void rasterize_tile_triangles(const tile_pass_context &ctx, F &&emit)
+    {
+        for (const std::uint32_t *entry = ctx.first_entry; entry != ctx.last_entry; ++entry)
+        {
+            const std::uint32_t i = *entry - ctx.triangle_offset;
+            const triangle_data &triangle = (*ctx.triangles)[i];
+
+            auto shade_fragment = [&](int idx, float px, float py, float interpolated_z)
+            {
+                emit(i, triangle, idx, px, py, interpolated_z);
+            };
+
+            switch (ctx.mode)
+            {
+            case raster_mode::scalar:
+                rasterize_triangle_scalar(triangle, *ctx.tile, ctx.depth_buffer, ctx.width, shade_fragment);
+                break;
+            case raster_mode::simd:
+                rasterize_triangle_simd(triangle, *ctx.tile, ctx.depth_buffer, ctx.width, shade_fragment);
+                break;
+            case raster_mode::hierarchical:
+                rasterize_triangle_hierarchical(triangle, *ctx.tile, ctx.depth_buffer, ctx.width, *ctx.hi_z, *ctx.stats, shade_fragment);
+                break;
+            }
+        }
+    }
+
+    // Forward tile pass instantiated per shader type, so shading is inlined and unused varyings are never interpolated.
+    // ShaderT = shader is the generic instantiation for shader types nobody registered.
+    template <typename ShaderT>
+    void forward_tile_pass(const tile_pass_context &ctx)
+    {
+        constexpr std::uint32_t varyings = ShaderT::used_varyings;
+
+        fragment_batcher<ShaderT> batcher(ctx.pixels);
+        batcher.set_shader(ctx.shader_ptr);
+
+        rasterize_tile_triangles(ctx, [&](std::uint32_t triangle_index, const triangle_data &triangle, int idx, float px, float py, float interpolated_z)
+                                 { emit_fragment<varyings>(batcher, triangle, (*ctx.attributes)[triangle_index], idx, px, py, interpolated_z); });
+
+        batcher.flush();
+    }
+
+    // Visibility buffer tile pass, only depth and ids are written
+    inline void visibility_tile_pass(const tile_pass_context &ctx)
+    {
+        rasterize_tile_triangles(ctx, [&](std::uint32_t triangle_index, const triangle_data &, int idx, float, float, float)
+                                 { ctx.visibility_buffer[idx] = visibility_sample{ctx.draw_index, triangle_index}; });
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <stdexcept>
 
@@ -105,6 +106,46 @@ namespace rasterizer
     struct vector4f
     {
         float x = 0.0f, y = 0.0f, z = 0.0f, w = 0.0f;
+
+        vector4f operator-(const vector4f &other) const
+        {
+            return vector4f{x - other.x, y - other.y, z - other.z, w - other.w};
+        }
+
+        vector4f operator+(const vector4f &other) const
+        {
+            return vector4f{x + other.x, y + other.y, z + other.z, w + other.w};
+        }
+
+        vector4f operator*(float scalar) const
+        {
+            return vector4f{x * scalar, y * scalar, z * scalar, w * scalar};
+        }
+    };
+
+    // Row-major, transforms column vectors, so a * b applies b first
+    struct matrix4f
+    {
+        float m[4][4] = {{1.0f, 0.0f, 0.0f, 0.0f},
+                         {0.0f, 1.0f, 0.0f, 0.0f},
+                         {0.0f, 0.0f, 1.0f, 0.0f},
+                         {0.0f, 0.0f, 0.0f, 1.0f}};
+
+        matrix4f operator*(const matrix4f &other) const
+        {
+            matrix4f result;
+            for (int row = 0; row < 4; ++row)
+            {
+                for (int column = 0; column < 4; ++column)
+                {
+                    result.m[row][column] = m[row][0] * other.m[0][column] +
+                                            m[row][1] * other.m[1][column] +
+                                            m[row][2] * other.m[2][column] +
+                                            m[row][3] * other.m[3][column];
+                }
+            }
+            return result;
+        }
     };
 
     struct color4ub
@@ -154,6 +195,18 @@ namespace rasterizer
         }
     };
 
+    struct bounding_box
+    {
+        vector3f min{0.0f, 0.0f, 0.0f};
+        vector3f max{0.0f, 0.0f, 0.0f};
+    };
+
+    struct bounding_sphere
+    {
+        vector3f center{0.0f, 0.0f, 0.0f};
+        float radius = 0.0f;
+    };
+
     struct mesh_data
     {
         std::vector<vector3f> positions;
@@ -169,18 +222,120 @@ namespace rasterizer
         std::vector<float> depth;
     };
 
+    // Texel layouts, the value is the size of one texel in bytes
+    enum class texture_format : std::uint8_t
+    {
+        r8 = 1,
+        rg8 = 2,
+        rgba8 = 4
+    };
+
+    // How texels of a mip level are ordered in memory
+    enum class texture_layout : std::uint8_t
+    {
+        row_major,
+        tiled // 4x4 texel tiles stored contiguously, one 64 byte cache line per rgba8 tile
+    };
+
+    // Screen-space derivatives of the texture coordinates, used to pick a mip level
+    struct texture_gradient
+    {
+        float du_dx = 0.0f, dv_dx = 0.0f;
+        float du_dy = 0.0f, dv_dy = 0.0f;
+    };
+
     struct texture
     {
         const int width = 0;
         const int height = 0;
+        const texture_format format = texture_format::rgba8;
 
-        inline texture(int width, int height, std::vector<vector3f> image_data)
+        // texels holds width * height texels packed in format, row major, rows top to bottom
+        inline texture(int width, int height, texture_format format, std::vector<std::uint8_t> texels)
             : width(width),
               height(height),
-              wscale(width - 1),
-              hscale(height - 1),
-              m_image_data(std::move(image_data))
+              format(format),
+              m_texels(std::move(texels))
+        {
+            if (m_texels.size() < static_cast<std::size_t>(width) * height * static_cast<std::size_t>(format))
+                throw std::runtime_error("Texture data smaller than width * height texels");
+
+            m_levels.push_back(make_level(width, height, 0));
+        }
+
+        int mip_count() const { return static_cast<int>(m_levels.size()); }
+
+        texture_layout layout() const { return m_layout; }
+
+        // Reorder every mip level into the given layout, sampling results are unchanged
+        inline void set_layout(texture_layout layout)
+        {
+            if (layout == m_layout)
+                return;
+
+            const std::vector<std::uint8_t> old_texels = std::move(m_texels);
+            const std::vector<mip_level> old_levels = std::move(m_levels);
+            const texture_layout old_layout = m_layout;
+            const std::size_t texel_size = static_cast<std::size_t>(format);
+
+            m_layout = layout;
+            m_texels.clear();
+            m_levels.clear();
+
+            for (const mip_level &old_level : old_levels)
+            {
+                const mip_level level = make_level(old_level.width, old_level.height, m_texels.size());
+                m_texels.resize(level.offset + level_bytes(level));
+
+                for (int y = 0; y < level.height; ++y)
+                {
+                    for (int x = 0; x < level.width; ++x)
+                    {
+                        const std::size_t src = old_level.offset + texel_index(old_layout, old_level, x, y) * texel_size;
+                        std::memcpy(texel_ptr(level, x, y), &old_texels[src], texel_size);
+                    }
+                }
+
+                m_levels.push_back(level);
+            }
+        }
+
+        // Box filter the full mip chain down to 1x1, each level appended after the previous one
+        inline void generate_mipmaps()
         {
+            const std::size_t texel_size = static_cast<std::size_t>(format);
+            m_levels.resize(1);
+            m_texels.resize(level_bytes(m_levels[0]));
+
+            while (m_levels.back().width > 1 || m_levels.back().height > 1)
+            {
+                const mip_level src = m_levels.back();
+                const mip_level dst = make_level(math::max(src.width / 2, 1), math::max(src.height / 2, 1), m_texels.size());
+                m_texels.resize(dst.offset + level_bytes(dst));
+
+                for (int y = 0; y < dst.height; ++y)
+                {
+                    const int y0 = math::min(y * 2, src.height - 1);
+                    const int y1 = math::min(y * 2 + 1, src.height - 1);
+
+                    for (int x = 0; x < dst.width; ++x)
+                    {
+                        const int x0 = math::min(x * 2, src.width - 1);
+                        const int x1 = math::min(x * 2 + 1, src.width - 1);
+
+                        const std::uint8_t *t00 = texel_ptr(src, x0, y0);
+                        const std::uint8_t *t10 = texel_ptr(src, x1, y0);
+                        const std::uint8_t *t01 = texel_ptr(src, x0, y1);
+                        const std::uint8_t *t11 = texel_ptr(src, x1, y1);
+                        std::uint8_t *out = texel_ptr(dst, x, y);
+
+                        for (std::size_t c = 0; c < texel_size; ++c)
+                            out[c] = static_cast<std::uint8_t>((t00[c] + t10[c] + t01[c] + t11[c] + 2) / 4);
+                    }
+                }
+
+                m_levels.push_back(dst);
+            }
         }
 
         inline vector3f sample_texture(float u, float v) const
@@ -192,40 +347,144 @@ namespace rasterizer
             if (wrapped_v < 0)
                 wrapped_v += 1.0f;
 
-            int x = static_cast<int>(wrapped_u * wscale);
-            int y = static_cast<int>(wrapped_v * hscale);
+            int x = static_cast<int>(wrapped_u * (width - 1));
+            int y = static_cast<int>(wrapped_v * (height - 1));
 
-            return m_image_data[y * width + x];
+            return fetch(texel_ptr(m_levels[0], x, y)) * INV_255;
         }
 
         inline vector3f sample_texture_bilinear(float u, float v) const
+        {
+            return sample_level_bilinear(m_levels[0], u, v);
+        }
+
+        // Mip level the gradient maps to, 0 when magnified
+        inline float compute_lod(const texture_gradient &gradient) const
+        {
+            const float dx_u = gradient.du_dx * width, dx_v = gradient.dv_dx * height;
+            const float dy_u = gradient.du_dy * width, dy_v = gradient.dv_dy * height;
+            const float rho_sq = math::max(dx_u * dx_u + dx_v * dx_v, dy_u * dy_u + dy_v * dy_v);
+            return math::clamp(0.5f * math::log2(rho_sq), 0.0f, static_cast<float>(m_levels.size() - 1));
+        }
+
+        // Trilinear sample, blending the two mip levels around the gradient's lod
+        inline vector3f sample_texture_grad(float u, float v, const texture_gradient &gradient) const
+        {
+            const float lod = compute_lod(gradient);
+            const int level = static_cast<int>(lod);
+            const float blend = lod - static_cast<float>(level);
+
+            const vector3f c0 = sample_level_bilinear(m_levels[level], u, v);
+            if (blend <= 0.0f || level + 1 >= mip_count())
+                return c0;
+
+            const vector3f c1 = sample_level_bilinear(m_levels[level + 1], u, v);
+            return c0 + (c1 - c0) * blend;
+        }
+
+    private:
+        static constexpr float INV_255 = 1.0f / 255.0f;
+
+        static constexpr int TEXTURE_TILE_SHIFT = 2; // 4x4 texel tiles
+
+        struct mip_level
+        {
+            int width;
+            int height;
+            int tiles_x;        // Tiles per row, rows are padded to whole tiles in the tiled layout
+            std::size_t offset; // First texel in m_texels, in bytes
+        };
+
+        std::vector<std::uint8_t> m_texels;
+        std::vector<mip_level> m_levels;
+        texture_layout m_layout = texture_layout::row_major;
+
+        static inline mip_level make_level(int width, int height, std::size_t offset)
+        {
+            constexpr int tile = 1 << TEXTURE_TILE_SHIFT;
+            return mip_level{width, height, (width + tile - 1) >> TEXTURE_TILE_SHIFT, offset};
+        }
+
+        inline std::size_t level_bytes(const mip_level &level) const
+        {
+            constexpr int tile = 1 << TEXTURE_TILE_SHIFT;
+            const std::size_t texel_size = static_cast<std::size_t>(format);
+            if (m_layout == texture_layout::row_major)
+                return static_cast<std::size_t>(level.width) * level.height * texel_size;
+
+            const std::size_t tiles_y = static_cast<std::size_t>((level.height + tile - 1) >> TEXTURE_TILE_SHIFT);
+            return static_cast<std::size_t>(level.tiles_x) * tiles_y * tile * tile * texel_size;
+        }
+
+        // Both layouts address separably, texel index = row_offset(y) + column_offset(x),
+        // so a bilinear footprint needs two of each instead of four full index computations
+        static inline std::size_t row_offset(texture_layout layout, const mip_level &level, int y)
+        {
+            if (layout == texture_layout::row_major)
+                return static_cast<std::size_t>(y) * level.width;
+
+            constexpr int mask = (1 << TEXTURE_TILE_SHIFT) - 1;
+            return ((static_cast<std::size_t>(y >> TEXTURE_TILE_SHIFT) * level.tiles_x) << (2 * TEXTURE_TILE_SHIFT)) +
+                   (static_cast<std::size_t>(y & mask) << TEXTURE_TILE_SHIFT);
+        }
+
+        static inline std::size_t column_offset(texture_layout layout, int x)
+        {
+            if (layout == texture_layout::row_major)
+                return static_cast<std::size_t>(x);
+
+            constexpr int mask = (1 << TEXTURE_TILE_SHIFT) - 1;
+            return (static_cast<std::size_t>(x >> TEXTURE_TILE_SHIFT) << (2 * TEXTURE_TILE_SHIFT)) + (x & mask);
+        }
+
+        static inline std::size_t texel_index(texture_layout layout, const mip_level &level, int x, int y)
+        {
+            return row_offset(layout, level, y) + column_offset(layout, x);
+        }
+
+        inline const std::uint8_t *texel_ptr(const mip_level &level, int x, int y) const
+        {
+            return m_texels.data() + level.offset + texel_index(m_layout, level, x, y) * static_cast<std::size_t>(format);
+        }
+
+        inline std::uint8_t *texel_ptr(const mip_level &level, int x, int y)
+        {
+            return m_texels.data() + level.offset + texel_index(m_layout, level, x, y) * static_cast<std::size_t>(format);
+        }
+
+        inline vector3f sample_level_bilinear(const mip_level &level, float u, float v) const
         {
             // Ensure u,v are in [0,1]
             u = u - math::floor(u);
             v = v - math::floor(v);
 
-            float fx = u * wscale;
-            float fy = v * hscale;
+            float fx = u * (level.width - 1);
+            float fy = v * (level.height - 1);
 
             int x0 = static_cast<int>(fx);
             int y0 = static_cast<int>(fy);
-            int x1 = (x0 + 1) & (width - 1);
-            int y1 = (y0 + 1) & (height - 1);
+            int x1 = (x0 + 1) & (level.width - 1);
+            int y1 = (y0 + 1) & (level.height - 1);
 
             float fx_fract = fx - x0;
             float fy_fract = fy - y0;
 
-            // Fetch the four texels
-            const vector3f &c00 = m_image_data[y0 * width + x0];
-            const vector3f &c10 = m_image_data[y0 * width + x1];
-            const vector3f &c01 = m_image_data[y1 * width + x0];
-            const vector3f &c11 = m_image_data[y1 * width + x1];
+            // Fetch the four texels, still in 0..255
+            const std::uint8_t *base = m_texels.data() + level.offset;
+            const std::size_t texel_size = static_cast<std::size_t>(format);
+            const std::size_t row0 = row_offset(m_layout, level, y0), row1 = row_offset(m_layout, level, y1);
+            const std::size_t col0 = column_offset(m_layout, x0), col1 = column_offset(m_layout, x1);
 
-            // Interpolate (can be optimized with SIMD)
-            float w00 = (1.0f - fx_fract) * (1.0f - fy_fract);
-            float w10 = fx_fract * (1.0f - fy_fract);
-            float w01 = (1.0f - fx_fract) * fy_fract;
-            float w11 = fx_fract * fy_fract;
+            const vector3f c00 = fetch(base + (row0 + col0) * texel_size);
+            const vector3f c10 = fetch(base + (row0 + col1) * texel_size);
+            const vector3f c01 = fetch(base + (row1 + col0) * texel_size);
+            const vector3f c11 = fetch(base + (row1 + col1) * texel_size);
+
+            // Fold the 1/255 normalization into the weights
+            float w00 = (1.0f - fx_fract) * (1.0f - fy_fract) * INV_255;
+            float w10 = fx_fract * (1.0f - fy_fract) * INV_255;
+            float w01 = (1.0f - fx_fract) * fy_fract * INV_255;
+            float w11 = fx_fract * fy_fract * INV_255;
 
             return vector3f{
                 c00.x * w00 + c10.x * w10 + c01.x * w01 + c11.x * w11,
@@ -233,12 +492,32 @@ namespace rasterizer
                 c00.z * w00 + c10.z * w10 + c01.z * w01 + c11.z * w11};
         }
 
-    private:
-        const int wscale;
-        const int hscale;
-        std::vector<vector3f> m_image_data;
+        // Unpack one texel to floats in 0..255, missing channels read as 0
+        inline vector3f fetch(const std::uint8_t *texel) const
+        {
+            switch (format)
+            {
+            case texture_format::r8:
+                return vector3f{static_cast<float>(texel[0]), 0.0f, 0.0f};
+            case texture_format::rg8:
+                return vector3f{static_cast<float>(texel[0]), static_cast<float>(texel[1]), 0.0f};
+            case texture_format::rgba8:
+                break;
+            }
+
+            std::uint32_t packed;
+            std::memcpy(&packed, texel, sizeof(packed));
+
+            return vector3f{
+                static_cast<float>(packed & 0xFF),
+                static_cast<float>((packed >> 8) & 0xFF),
+                static_cast<float>((packed >> 16) & 0xFF)};
+        }
     };
 
+    // Screen tiles are the unit of work of the tile pass
+    constexpr int TILE_SIZE = 64;
+
     struct screen_tile
     {
         int min_x = 0, min_y = 0;
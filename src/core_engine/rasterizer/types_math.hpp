@@ -48,6 +48,30 @@ namespace rasterizer
             a.x * b.y - a.y * b.x};
     }
 
+    //
+    // Matrix Functions
+    //
+
+    inline vector4f transform_point(const matrix4f &matrix, const vector3f &p)
+    {
+        const auto &m = matrix.m;
+        return vector4f{
+            m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+            m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+            m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3],
+            m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z + m[3][3]};
+    }
+
+    // Skips the bottom row, only for matrices without projection
+    inline vector3f transform_position(const matrix4f &matrix, const vector3f &p)
+    {
+        const auto &m = matrix.m;
+        return vector3f{
+            m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+            m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+            m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]};
+    }
+
     //
     // Triangle Functions
     //
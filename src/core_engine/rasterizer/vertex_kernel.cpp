@@ -0,0 +1,109 @@
+#include "rasterizer/vertex_kernel.hpp"
+
+#include "helper/simd_math.hpp"
+#include "rasterizer/types_math.hpp"
+
+namespace rasterizer
+{
+    position_stream make_position_stream(const std::vector<vector3f> &positions)
+    {
+        position_stream stream;
+        stream.x.reserve(positions.size());
+        stream.y.reserve(positions.size());
+        stream.z.reserve(positions.size());
+        for (const vector3f &p : positions)
+        {
+            stream.x.push_back(p.x);
+            stream.y.push_back(p.y);
+            stream.z.push_back(p.z);
+        }
+        return stream;
+    }
+
+    std::uint8_t compute_outcode(const vector4f &clip, const clip_volume &volume)
+    {
+        // Homogeneous tests, so they hold behind the eye too
+        const float guard_w = GUARD_BAND_LIMIT * clip.w;
+        return static_cast<std::uint8_t>(
+            (clip.x < 0.0f ? OUTSIDE_LEFT : 0) |
+            (volume.width * clip.w < clip.x ? OUTSIDE_RIGHT : 0) |
+            (clip.y < 0.0f ? OUTSIDE_TOP : 0) |
+            (volume.height * clip.w < clip.y ? OUTSIDE_BOTTOM : 0) |
+            (clip.w <= volume.near_clip ? OUTSIDE_NEAR : 0) |
+            (volume.far_clip < clip.w ? OUTSIDE_FAR : 0) |
+            (clip.x < -guard_w || guard_w < clip.x || clip.y < -guard_w || guard_w < clip.y ? OUTSIDE_GUARD_BAND : 0));
+    }
+
+    std::uint8_t transform_vertices(const position_stream &positions, std::uint32_t first, std::uint32_t count,
+                                    const matrix4f &model_view_projection, const clip_volume &volume,
+                                    transformed_vertex *out, std::uint8_t *outcodes)
+    {
+        // Only the x, y and w rows matter, the z row is never read
+        const auto &m = model_view_projection.m;
+        const simd::float_v m00 = simd::set1(m[0][0]), m01 = simd::set1(m[0][1]), m02 = simd::set1(m[0][2]), m03 = simd::set1(m[0][3]);
+        const simd::float_v m10 = simd::set1(m[1][0]), m11 = simd::set1(m[1][1]), m12 = simd::set1(m[1][2]), m13 = simd::set1(m[1][3]);
+        const simd::float_v m30 = simd::set1(m[3][0]), m31 = simd::set1(m[3][1]), m32 = simd::set1(m[3][2]), m33 = simd::set1(m[3][3]);
+        const simd::float_v one = simd::set1(1.0f);
+        const simd::float_v zero = simd::set1(0.0f);
+        const simd::float_v width = simd::set1(volume.width);
+        const simd::float_v height = simd::set1(volume.height);
+        const simd::float_v near_clip = simd::set1(volume.near_clip);
+        const simd::float_v far_clip = simd::set1(volume.far_clip);
+        const simd::float_v guard_band = simd::set1(GUARD_BAND_LIMIT);
+        const simd::float_v negative_guard_band = simd::set1(-GUARD_BAND_LIMIT);
+
+        std::uint8_t outcode_union = 0;
+        std::uint32_t i = first;
+        const std::uint32_t end = first + count;
+
+        for (; i + simd::WIDTH <= end; i += simd::WIDTH)
+        {
+            const simd::float_v x = simd::load(positions.x.data() + i);
+            const simd::float_v y = simd::load(positions.y.data() + i);
+            const simd::float_v z = simd::load(positions.z.data() + i);
+
+            // Summed in the same order as transform_point, so clipping agrees with the cached classification
+            const simd::float_v clip_x = simd::add(simd::add(simd::add(simd::mul(m00, x), simd::mul(m01, y)), simd::mul(m02, z)), m03);
+            const simd::float_v clip_y = simd::add(simd::add(simd::add(simd::mul(m10, x), simd::mul(m11, y)), simd::mul(m12, z)), m13);
+            const simd::float_v clip_w = simd::add(simd::add(simd::add(simd::mul(m30, x), simd::mul(m31, y)), simd::mul(m32, z)), m33);
+
+            // Lanes behind the near plane divide by a tiny or negative w, their results are left unused
+            const simd::float_v inv_w = simd::div(one, clip_w);
+            simd::store_interleaved4(&out[i].screen.x, simd::mul(clip_x, inv_w), simd::mul(clip_y, inv_w), inv_w, clip_w);
+
+            // One lane mask per outcode bit, in bit order
+            const simd::float_v guard_w = simd::mul(guard_band, clip_w);
+            const simd::float_v negative_guard_w = simd::mul(negative_guard_band, clip_w);
+            const int plane_masks[7] = {
+                simd::move_mask(simd::cmp_lt(clip_x, zero)),
+                simd::move_mask(simd::cmp_lt(simd::mul(width, clip_w), clip_x)),
+                simd::move_mask(simd::cmp_lt(clip_y, zero)),
+                simd::move_mask(simd::cmp_lt(simd::mul(height, clip_w), clip_y)),
+                simd::move_mask(simd::cmp_le(clip_w, near_clip)),
+                simd::move_mask(simd::cmp_lt(far_clip, clip_w)),
+                simd::move_mask(simd::bit_or(simd::bit_or(simd::cmp_lt(clip_x, negative_guard_w), simd::cmp_lt(guard_w, clip_x)),
+                                             simd::bit_or(simd::cmp_lt(clip_y, negative_guard_w), simd::cmp_lt(guard_w, clip_y))))};
+
+            for (int lane = 0; lane < simd::WIDTH; ++lane)
+            {
+                std::uint8_t outcode = 0;
+                for (int bit = 0; bit < 7; ++bit)
+                    outcode |= static_cast<std::uint8_t>(((plane_masks[bit] >> lane) & 1) << bit);
+                outcodes[i + lane] = outcode;
+                outcode_union |= outcode;
+            }
+        }
+
+        // Leftovers go one at a time, the next lanes belong to other meshlets and may be written by other jobs
+        for (; i < end; ++i)
+        {
+            const vector4f clip = transform_point(model_view_projection, vector3f{positions.x[i], positions.y[i], positions.z[i]});
+            const float inv_w = 1.0f / clip.w;
+            out[i] = transformed_vertex{vector2f{clip.x * inv_w, clip.y * inv_w}, inv_w, clip.w};
+            outcodes[i] = compute_outcode(clip, volume);
+            outcode_union |= outcodes[i];
+        }
+
+        return outcode_union;
+    }
+}
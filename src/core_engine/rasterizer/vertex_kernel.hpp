@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "rasterizer/types.hpp"
+
+namespace rasterizer
+{
+    // Positions split per component, so the vertex kernel loads WIDTH of them with one load per axis
+    struct position_stream
+    {
+        std::vector<float> x, y, z;
+    };
+
+    position_stream make_position_stream(const std::vector<vector3f> &positions);
+
+    // One vertex after the model-view-projection matrix and the divide by w.
+    // screen and inv_depth are only meaningful in front of the near plane.
+    struct transformed_vertex
+    {
+        vector2f screen;
+        float inv_depth;
+        float depth; // View depth, the w the divide used
+    };
+
+    static_assert(sizeof(transformed_vertex) == 4 * sizeof(float), "the vertex kernel stores four floats per vertex");
+
+    // Triangles are drawn unclipped as long as they stay within +-GUARD_BAND_LIMIT screen pixels
+    constexpr float GUARD_BAND_LIMIT = static_cast<float>(1 << 20);
+
+    // Outcode bits, each set when the vertex is outside one plane. Triangles whose corners share a view volume bit
+    // are fully outside, the others only get clipped against near, far and the guard band.
+    constexpr std::uint8_t OUTSIDE_LEFT = 1 << 0;
+    constexpr std::uint8_t OUTSIDE_RIGHT = 1 << 1;
+    constexpr std::uint8_t OUTSIDE_TOP = 1 << 2;
+    constexpr std::uint8_t OUTSIDE_BOTTOM = 1 << 3;
+    constexpr std::uint8_t OUTSIDE_NEAR = 1 << 4;
+    constexpr std::uint8_t OUTSIDE_FAR = 1 << 5;
+    constexpr std::uint8_t OUTSIDE_GUARD_BAND = 1 << 6; // Any of the four sides
+    constexpr std::uint8_t OUTSIDE_VIEW_VOLUME = (1 << 6) - 1;
+    constexpr std::uint8_t NEEDS_CLIPPING = OUTSIDE_NEAR | OUTSIDE_FAR | OUTSIDE_GUARD_BAND;
+
+    // What vertices are classified against, in screen pixels and view depth
+    struct clip_volume
+    {
+        float width, height;
+        float near_clip, far_clip;
+    };
+
+    // Transforms and projects positions [first, first + count) into out[first, first + count) and classifies them
+    // into outcodes[first, first + count), SIMD WIDTH vertices per iteration. model_view_projection maps to screen
+    // pixels times w, like camera::get_view_projection. Returns the outcodes of all of them or-ed together.
+    std::uint8_t transform_vertices(const position_stream &positions, std::uint32_t first, std::uint32_t count,
+                                    const matrix4f &model_view_projection, const clip_volume &volume,
+                                    transformed_vertex *out, std::uint8_t *outcodes);
+
+    // Same classification for a single clip space position
+    std::uint8_t compute_outcode(const vector4f &clip, const clip_volume &volume);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#include "rasterizer/types.hpp"
+#include "shader/shader.hpp"
+
+namespace rasterizer
+{
+    // Collects fragments into SoA packets and shades a full packet with one shade_packet call.
+    // Fragments are written back in the order they were added, so overdraw inside a packet resolves
+    // the same way as shading them one by one.
+    // With a concrete ShaderT the packet call is made non-virtually so it can be inlined.
+    template <typename ShaderT = shader>
+    class fragment_batcher
+    {
+    public:
+        explicit fragment_batcher(std::uint32_t *pixels) : m_pixels(pixels) {}
+
+        // Switching shader shades what was collected for the previous one first
+        void set_shader(const shader *shader_ptr)
+        {
+            if (shader_ptr == m_shader)
+                return;
+
+            flush();
+            m_shader = shader_ptr;
+        }
+
+        void add(int pixel_index, float px, float py, float z, const vector3f &normal, const vector2f &tex_coord,
+                 const texture_gradient &tex_gradient)
+        {
+            const int lane = m_count;
+            m_pixel_index[lane] = pixel_index;
+            m_packet.position_x[lane] = px;
+            m_packet.position_y[lane] = py;
+            m_packet.position_z[lane] = z;
+            m_packet.normal_x[lane] = normal.x;
+            m_packet.normal_y[lane] = normal.y;
+            m_packet.normal_z[lane] = normal.z;
+            m_packet.tex_u[lane] = tex_coord.x;
+            m_packet.tex_v[lane] = tex_coord.y;
+            m_packet.tex_du_dx[lane] = tex_gradient.du_dx;
+            m_packet.tex_dv_dx[lane] = tex_gradient.dv_dx;
+            m_packet.tex_du_dy[lane] = tex_gradient.du_dy;
+            m_packet.tex_dv_dy[lane] = tex_gradient.dv_dy;
+
+            if (++m_count == SHADE_PACKET_SIZE)
+                flush();
+        }
+
+        void flush()
+        {
+            if (m_count == 0)
+                return;
+
+            if (!m_shader)
+            {
+                for (int i = 0; i < m_count; ++i)
+                    m_pixels[m_pixel_index[i]] = rasterizer::to_uint32(vector3f{1.0f, 0.0f, 1.0f});
+                m_count = 0;
+                return;
+            }
+
+            // Pad unused lanes with lane 0 so they never feed garbage into texture lookups
+            for (int i = m_count; i < SHADE_PACKET_SIZE; ++i)
+            {
+                m_packet.position_x[i] = m_packet.position_x[0];
+                m_packet.position_y[i] = m_packet.position_y[0];
+                m_packet.position_z[i] = m_packet.position_z[0];
+                m_packet.normal_x[i] = m_packet.normal_x[0];
+                m_packet.normal_y[i] = m_packet.normal_y[0];
+                m_packet.normal_z[i] = m_packet.normal_z[0];
+                m_packet.tex_u[i] = m_packet.tex_u[0];
+                m_packet.tex_v[i] = m_packet.tex_v[0];
+                m_packet.tex_du_dx[i] = m_packet.tex_du_dx[0];
+                m_packet.tex_dv_dx[i] = m_packet.tex_dv_dx[0];
+                m_packet.tex_du_dy[i] = m_packet.tex_du_dy[0];
+                m_packet.tex_dv_dy[i] = m_packet.tex_dv_dy[0];
+            }
+
+            const std::uint32_t active_mask = (1u << m_count) - 1u;
+            if constexpr (std::is_same_v<ShaderT, shader>)
+                m_shader->shade_packet(m_packet, active_mask, m_colors);
+            else
+                static_cast<const ShaderT *>(m_shader)->ShaderT::shade_packet(m_packet, active_mask, m_colors);
+
+            for (int i = 0; i < m_count; ++i)
+                m_pixels[m_pixel_index[i]] = rasterizer::to_uint32(vector3f{m_colors.r[i], m_colors.g[i], m_colors.b[i]});
+
+            m_count = 0;
+        }
+
+    private:
+        std::uint32_t *m_pixels = nullptr;
+        const shader *m_shader = nullptr;
+
+        fragment_packet m_packet;
+        color_packet m_colors;
+        int m_pixel_index[SHADE_PACKET_SIZE];
+        int m_count = 0;
+    };
+}
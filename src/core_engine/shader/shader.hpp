@@ -6,19 +6,109 @@
 
 namespace rasterizer
 {
+    // Varyings a shader reads. The specialized raster kernels skip interpolating the others.
+    enum varying_flags : std::uint32_t
+    {
+        varying_normal = 1u << 0,
+        varying_tex_coord = 1u << 1,
+        varying_tex_gradient = 1u << 2, // Screen-space derivatives of tex_coord, for mip selection
+        varying_all = varying_normal | varying_tex_coord | varying_tex_gradient
+    };
+
+    //
+    // Packets
+    //
+
+    constexpr int SHADE_PACKET_SIZE = 8;
+
+    // Fragments shaded together in SoA form. Lanes outside the active mask hold copies of an
+    // active lane, so shaders can run every lane branch-free and only active lanes are written.
+    struct fragment_packet
+    {
+        alignas(32) float position_x[SHADE_PACKET_SIZE];
+        alignas(32) float position_y[SHADE_PACKET_SIZE];
+        alignas(32) float position_z[SHADE_PACKET_SIZE];
+        alignas(32) float normal_x[SHADE_PACKET_SIZE];
+        alignas(32) float normal_y[SHADE_PACKET_SIZE];
+        alignas(32) float normal_z[SHADE_PACKET_SIZE];
+        alignas(32) float tex_u[SHADE_PACKET_SIZE];
+        alignas(32) float tex_v[SHADE_PACKET_SIZE];
+        alignas(32) float tex_du_dx[SHADE_PACKET_SIZE];
+        alignas(32) float tex_dv_dx[SHADE_PACKET_SIZE];
+        alignas(32) float tex_du_dy[SHADE_PACKET_SIZE];
+        alignas(32) float tex_dv_dy[SHADE_PACKET_SIZE];
+
+        rasterizer::texture_gradient tex_gradient(int lane, float scale = 1.0f) const
+        {
+            return rasterizer::texture_gradient{tex_du_dx[lane] * scale, tex_dv_dx[lane] * scale,
+                                                tex_du_dy[lane] * scale, tex_dv_dy[lane] * scale};
+        }
+    };
+
+    struct color_packet
+    {
+        alignas(32) float r[SHADE_PACKET_SIZE];
+        alignas(32) float g[SHADE_PACKET_SIZE];
+        alignas(32) float b[SHADE_PACKET_SIZE];
+
+        void set(int lane, const rasterizer::vector3f &color)
+        {
+            r[lane] = color.x;
+            g[lane] = color.y;
+            b[lane] = color.z;
+        }
+    };
+
+    // (dot(normalized_vector(normal), dir) + 1) / 2 for every lane
+    inline void packet_half_lambert(const fragment_packet &in, const rasterizer::vector3f &dir, float *out_intensity)
+    {
+        for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+        {
+            float len = math::sqrt(in.normal_x[i] * in.normal_x[i] + in.normal_y[i] * in.normal_y[i] + in.normal_z[i] * in.normal_z[i]);
+            float inv_len = len > 1e-6f ? 1.0f / len : 0.0f;
+            float d = (in.normal_x[i] * dir.x + in.normal_y[i] * dir.y + in.normal_z[i] * dir.z) * inv_len;
+            out_intensity[i] = (d + 1.0f) * 0.5f;
+        }
+    }
+
+    //
+    // Shaders
+    //
+
     class shader
     {
     public:
+        // Derived shaders narrow this to what they actually read
+        static constexpr std::uint32_t used_varyings = varying_all;
+
         virtual ~shader() = default;
 
+        // One fragment without texture gradients, textured shaders sample it like shade_packet does at mip level 0
         virtual rasterizer::vector3f shade(const rasterizer::vector3f &position,
                                            const rasterizer::vector3f &normal,
                                            const rasterizer::vector2f &tex_coord) const = 0;
+
+        // Shade SHADE_PACKET_SIZE fragments at once, one virtual call per packet.
+        // Falls back to shade() per active lane for shaders that don't override it.
+        virtual void shade_packet(const fragment_packet &in, std::uint32_t active_mask, color_packet &out) const
+        {
+            for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+            {
+                if (!(active_mask & (1u << i)))
+                    continue;
+
+                out.set(i, shade(rasterizer::vector3f{in.position_x[i], in.position_y[i], in.position_z[i]},
+                                 rasterizer::vector3f{in.normal_x[i], in.normal_y[i], in.normal_z[i]},
+                                 rasterizer::vector2f{in.tex_u[i], in.tex_v[i]}));
+            }
+        }
     };
 
     class texture_shader : public shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = varying_tex_coord | varying_tex_gradient;
+
         rasterizer::texture texture;
 
         texture_shader(const std::string &filepath)
@@ -32,14 +122,22 @@ namespace rasterizer
         {
             (void)position;
             (void)normal;
-            // return texture.sample_texture(tex_coord.x, tex_coord.y);
-            return texture.sample_texture_bilinear(tex_coord.x, tex_coord.y);
+            return texture.sample_texture_grad(tex_coord.x, tex_coord.y, texture_gradient{});
+        }
+
+        void shade_packet(const fragment_packet &in, std::uint32_t active_mask, color_packet &out) const override
+        {
+            (void)active_mask;
+            for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+                out.set(i, texture.sample_texture_grad(in.tex_u[i], in.tex_v[i], in.tex_gradient(i)));
         }
     };
 
     class lit_shader : public shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = varying_normal;
+
         rasterizer::vector3f light_direction = {0.0f, 0.0f, 0.0f};
 
         lit_shader(const rasterizer::vector3f &light_dir) : light_direction(std::move(light_dir)) {}
@@ -54,11 +152,24 @@ namespace rasterizer
             float light_intensity = (rasterizer::dot(norm, light_direction) + 1.0f) * 0.5f;
             return vector3f{1.0f, 1.0f, 1.0f} * light_intensity;
         }
+
+        void shade_packet(const fragment_packet &in, std::uint32_t active_mask, color_packet &out) const override
+        {
+            (void)active_mask;
+            packet_half_lambert(in, light_direction, out.r);
+            for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+            {
+                out.g[i] = out.r[i];
+                out.b[i] = out.r[i];
+            }
+        }
     };
 
     class lit_texture : public shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = varying_normal | varying_tex_coord | varying_tex_gradient;
+
         rasterizer::texture texture;
         rasterizer::vector3f light_direction;
         float texture_scale = 1;
@@ -73,13 +184,27 @@ namespace rasterizer
             (void)position;
             rasterizer::vector3f norm = normalized_vector(normal);
             float light_intensity = (rasterizer::dot(norm, light_direction) + 1.0f) * 0.5f;
-            return texture.sample_texture(tex_coord.x * texture_scale, tex_coord.y * texture_scale) * light_intensity;
+            return texture.sample_texture_grad(tex_coord.x * texture_scale, tex_coord.y * texture_scale, texture_gradient{}) *
+                   light_intensity;
+        }
+
+        void shade_packet(const fragment_packet &in, std::uint32_t active_mask, color_packet &out) const override
+        {
+            (void)active_mask;
+            alignas(32) float light_intensity[SHADE_PACKET_SIZE];
+            packet_half_lambert(in, light_direction, light_intensity);
+            for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+                out.set(i, texture.sample_texture_grad(in.tex_u[i] * texture_scale, in.tex_v[i] * texture_scale,
+                                                       in.tex_gradient(i, texture_scale)) *
+                               light_intensity[i]);
         }
     };
 
     class normal_visual_shader : public shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = varying_normal;
+
         rasterizer::vector3f shade(const rasterizer::vector3f &position,
                                    const rasterizer::vector3f &normal,
                                    const rasterizer::vector2f &tex_coord) const override
@@ -92,5 +217,18 @@ namespace rasterizer
                 (norm.y + 1.0f) * 0.5f,
                 (norm.z + 1.0f) * 0.5f};
         }
+
+        void shade_packet(const fragment_packet &in, std::uint32_t active_mask, color_packet &out) const override
+        {
+            (void)active_mask;
+            for (int i = 0; i < SHADE_PACKET_SIZE; ++i)
+            {
+                float len = math::sqrt(in.normal_x[i] * in.normal_x[i] + in.normal_y[i] * in.normal_y[i] + in.normal_z[i] * in.normal_z[i]);
+                float inv_len = len > 1e-6f ? 1.0f / len : 0.0f;
+                out.r[i] = (in.normal_x[i] * inv_len + 1.0f) * 0.5f;
+                out.g[i] = (in.normal_y[i] * inv_len + 1.0f) * 0.5f;
+                out.b[i] = (in.normal_z[i] * inv_len + 1.0f) * 0.5f;
+            }
+        }
     };
 }
@@ -67,6 +67,10 @@ namespace demo
         terrain_transform.scale = {1.0f, 1.0f, 1.0f};
         terrain_transform.position = {0.0f, -15.0f, 0.0f};
 
+        // Specialized raster kernels for the demo shaders
+        register_shader_kernel<demo::terrain_shader>();
+        register_shader_kernel<demo::cloud_shader>();
+
         // Terrrain shader
         demo::terrain_shader terrainShader(rasterizer::vector3f{0.0f, -1.0f, 0.0f});
         m_shaders.push_back(std::make_unique<demo::terrain_shader>(terrainShader));
@@ -87,17 +91,16 @@ namespace demo
     void demo_engine::render_models()
     {
 
-        for (auto &model : m_models)
+        for (std::uint32_t model_index : m_visible_models)
         {
-            if (!is_model_visible(model, m_camera))
-                continue;
+            rasterizer::model &model = m_models[model_index];
 
             // Process model
-            process_model(model, m_camera, m_screen);
+            process_model(model, m_camera, m_frustum, m_screen, m_job_system, m_frame_stats);
 
-            model.fill_triangle_data();
+            m_frame_stats.triangles_culled += model.fill_triangle_data(m_job_system);
 
-            draw_to_pixel_tiled(model, m_depth_buffer, m_color_buffer);
+            queue_draw(model);
         }
     }
 
@@ -23,6 +23,8 @@ namespace demo
     class terrain_shader : public rasterizer::shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = rasterizer::varying_normal | rasterizer::varying_tex_coord;
+
         rasterizer::vector3f light_direction = {0.0f, 0.0f, 0.0f};
         std::vector<float> height = {0.0f, 0.6f, 2.5f, 12.0f};
         rasterizer::vector3f sky_color = {0.6f, 0.8f, 1.0f};
@@ -33,6 +35,8 @@ namespace demo
             {0.5f, 0.35f, 0.3f},         // Mountain
             {0.93f, 0.93f, 0.91f}};      // Snow
 
+        static constexpr float atmosphere_density = 0.0075f;
+
         terrain_shader(const rasterizer::vector3f &light_dir) : light_direction(std::move(light_dir)) {}
 
         rasterizer::vector3f shade(const rasterizer::vector3f &position,
@@ -53,17 +57,42 @@ namespace demo
             float light_intensity = (rasterizer::dot(rasterizer::normalized_vector(normal), light_direction) + 1.0f) * 0.5f;
             terrain_color = terrain_color * light_intensity;
 
-            constexpr float atmosphere_density = 0.0075f;
             float aerial_perspective_t = 1.0f - math::exp(-position.z * atmosphere_density);
             rasterizer::vector3f final_color = math::lerp(terrain_color, sky_color, aerial_perspective_t);
 
             return final_color;
         }
+
+        void shade_packet(const rasterizer::fragment_packet &in, std::uint32_t active_mask [[maybe_unused]],
+                          rasterizer::color_packet &out) const override
+        {
+            alignas(32) float light_intensity[rasterizer::SHADE_PACKET_SIZE];
+            rasterizer::packet_half_lambert(in, light_direction, light_intensity);
+
+            for (int i = 0; i < rasterizer::SHADE_PACKET_SIZE; ++i)
+            {
+                float triangle_height = in.tex_u[i];
+                rasterizer::vector3f terrain_color = colours[0];
+
+                for (unsigned int h = 0; h < height.size(); h++)
+                {
+                    if (triangle_height > height[h])
+                        terrain_color = colours[h + 1];
+                    else
+                        break;
+                }
+
+                float aerial_perspective_t = 1.0f - math::exp(-in.position_z[i] * atmosphere_density);
+                out.set(i, math::lerp(terrain_color * light_intensity[i], sky_color, aerial_perspective_t));
+            }
+        }
     };
 
     class cloud_shader : public rasterizer::shader
     {
     public:
+        static constexpr std::uint32_t used_varyings = rasterizer::varying_normal;
+
         rasterizer::vector3f light_direction = {0.0f, 0.0f, 0.0f};
         rasterizer::vector3f tint;
         rasterizer::vector3f atmos_col;
@@ -83,5 +112,19 @@ namespace demo
             rasterizer::vector3f final_color = math::lerp(tint * light_intensity, atmos_col, t);
             return final_color;
         }
+
+        void shade_packet(const rasterizer::fragment_packet &in, std::uint32_t active_mask [[maybe_unused]],
+                          rasterizer::color_packet &out) const override
+        {
+            alignas(32) float light_intensity[rasterizer::SHADE_PACKET_SIZE];
+            rasterizer::packet_half_lambert(in, light_direction, light_intensity);
+
+            for (int i = 0; i < rasterizer::SHADE_PACKET_SIZE; ++i)
+            {
+                float intensity = math::lerp(0.8f, 1.0f, light_intensity[i]);
+                float t = 1 - math::exp(-in.position_z[i] * 0.0075f);
+                out.set(i, math::lerp(tint * intensity, atmos_col, t));
+            }
+        }
     };
 };
@@ -0,0 +1,167 @@
+// Interpolation precision of the setup-time plane equations against the per-pixel barycentric sum they
+// replaced. Random triangles at three sizes with depth ratios up to 10^4 are interpolated both ways at
+// pixel centres inside them and compared with a double precision reference. Fails if the planes are
+// less precise than the barycentric path or exceed their error bounds.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+#include "rasterizer/model.hpp"
+
+using namespace rasterizer;
+
+static constexpr int TRIANGLES_PER_SIZE = 20000;
+static constexpr int SAMPLES_PER_TRIANGLE = 16;
+static constexpr float TEXTURE_SIZE = 256.0f; // tex errors are reported in texels of this size
+
+struct size_class
+{
+    const char *name;
+    float extent;           // Corners spread this many pixels around the centre
+    double max_tex_error;   // Texels
+    double mean_tex_error;  // Texels
+    double max_depth_error; // Relative to the depth
+};
+
+struct error_stats
+{
+    double max_tex = 0.0, sum_tex = 0.0;
+    double max_depth = 0.0;
+    long samples = 0;
+
+    void add(double tex_error, double depth_error)
+    {
+        max_tex = std::max(max_tex, tex_error);
+        sum_tex += tex_error;
+        max_depth = std::max(max_depth, depth_error);
+        ++samples;
+    }
+};
+
+// The barycentric planes the previous setup stored, relative to the screen origin
+struct barycentric_setup
+{
+    plane_equation e0, e1, e2;
+
+    barycentric_setup(const vector2f &p0, const vector2f &p1, const vector2f &p2, double area)
+    {
+        const float inv_area = static_cast<float>(1.0 / area);
+        e0 = {(p1.y - p2.y) * inv_area, (p2.x - p1.x) * inv_area, 0.0f};
+        e1 = {(p2.y - p0.y) * inv_area, (p0.x - p2.x) * inv_area, 0.0f};
+        e2 = {(p0.y - p1.y) * inv_area, (p1.x - p0.x) * inv_area, 0.0f};
+        e0.c = -(e0.a * p2.x + e0.b * p2.y);
+        e1.c = -(e1.a * p2.x + e1.b * p2.y);
+        e2.c = -(e2.a * p0.x + e2.b * p0.y);
+    }
+};
+
+int main()
+{
+    const size_class sizes[] = {
+        {"4 px", 4.0f, 1.0, 0.001, 1e-3},
+        {"64 px", 64.0f, 10.0, 0.002, 1e-2},
+        {"1500 px", 1500.0f, 20.0, 0.002, 1e-2}};
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    bool passed = true;
+
+    for (const size_class &size : sizes)
+    {
+        error_stats barycentric, planes;
+
+        for (int t = 0; t < TRIANGLES_PER_SIZE; ++t)
+        {
+            const float centre_x = unit(rng) * 1920.0f, centre_y = unit(rng) * 1080.0f;
+            setup_vertex corners[3];
+            double depth[3], tex_u[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                depth[k] = 0.05f * std::pow(10000.0f, unit(rng));
+                tex_u[k] = unit(rng) * 8.0f;
+                const float inv_depth = static_cast<float>(1.0 / depth[k]);
+                corners[k] = setup_vertex{{centre_x + (unit(rng) - 0.5f) * size.extent, centre_y + (unit(rng) - 0.5f) * size.extent},
+                                          inv_depth,
+                                          vector2f{static_cast<float>(tex_u[k]), unit(rng) * 8.0f} * inv_depth,
+                                          vector3f{0.0f, 0.0f, 0.0f}};
+            }
+
+            triangle_data triangle;
+            triangle_attributes attributes;
+            if (setup_triangle(corners[0], corners[1], corners[2], triangle, attributes) != setup_result::drawn)
+                continue;
+
+            // Both paths see the snapped corners
+            double x[3], y[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                x[k] = static_cast<double>(to_fixed(corners[k].position.x)) / SUBPIXEL_SCALE;
+                y[k] = static_cast<double>(to_fixed(corners[k].position.y)) / SUBPIXEL_SCALE;
+            }
+            const double area = (y[1] - y[2]) * (x[0] - x[2]) + (x[2] - x[1]) * (y[0] - y[2]);
+            const barycentric_setup old_setup({static_cast<float>(x[0]), static_cast<float>(y[0])},
+                                              {static_cast<float>(x[1]), static_cast<float>(y[1])},
+                                              {static_cast<float>(x[2]), static_cast<float>(y[2])}, area);
+
+            for (int s = 0; s < SAMPLES_PER_TRIANGLE; ++s)
+            {
+                // Pixel centre next to a random point inside, skipped when it falls outside
+                double b0 = unit(rng), b1 = unit(rng);
+                if (b0 + b1 > 1.0)
+                {
+                    b0 = 1.0 - b0;
+                    b1 = 1.0 - b1;
+                }
+                const float px = std::floor(b0 * x[0] + b1 * x[1] + (1.0 - b0 - b1) * x[2]) + 0.5f;
+                const float py = std::floor(b0 * y[0] + b1 * y[1] + (1.0 - b0 - b1) * y[2]) + 0.5f;
+
+                double w[3];
+                w[0] = ((y[1] - y[2]) * (px - x[2]) + (x[2] - x[1]) * (py - y[2])) / area;
+                w[1] = ((y[2] - y[0]) * (px - x[2]) + (x[0] - x[2]) * (py - y[2])) / area;
+                w[2] = 1.0 - w[0] - w[1];
+                if (w[0] < 0.0 || w[1] < 0.0 || w[2] < 0.0)
+                    continue;
+
+                double inv_depth = 0.0, u_over_depth = 0.0;
+                for (int k = 0; k < 3; ++k)
+                {
+                    inv_depth += w[k] / depth[k];
+                    u_over_depth += w[k] * tex_u[k] / depth[k];
+                }
+                const double reference_z = 1.0 / inv_depth;
+                const double reference_u = u_over_depth * reference_z;
+
+                auto add = [&](error_stats &stats, float z, float u)
+                {
+                    stats.add(std::fabs(u - reference_u) * TEXTURE_SIZE, std::fabs(z - reference_z) / reference_z);
+                };
+
+                const float w0 = old_setup.e0.evaluate(px, py);
+                const float w1 = old_setup.e1.evaluate(px, py);
+                const float w2 = old_setup.e2.evaluate(px, py);
+                const float old_z = 1.0f / (triangle.inv_depth.x * w0 + triangle.inv_depth.y * w1 + triangle.inv_depth.z * w2);
+                add(barycentric, old_z, (corners[0].tex_coord.x * w0 + corners[1].tex_coord.x * w1 + corners[2].tex_coord.x * w2) * old_z);
+
+                // Planes are relative to the bounds corner
+                const float dx = px - triangle.minX, dy = py - triangle.minY;
+                const float z = 1.0f / triangle.inv_depth_plane.evaluate(dx, dy);
+                add(planes, z, attributes.tex_u.evaluate(dx, dy) * z);
+            }
+        }
+
+        const bool size_passed = planes.samples > 0 &&
+                                 planes.max_tex <= size.max_tex_error && planes.sum_tex / planes.samples <= size.mean_tex_error &&
+                                 planes.max_depth <= size.max_depth_error &&
+                                 planes.max_tex <= barycentric.max_tex && planes.max_depth <= barycentric.max_depth;
+        passed = passed && size_passed;
+
+        std::printf("%-8s barycentric u max %7.3f mean %.5f z max %.1e | planes u max %7.3f mean %.5f z max %.1e | %ld samples %s\n",
+                    size.name, barycentric.max_tex, barycentric.sum_tex / barycentric.samples, barycentric.max_depth,
+                    planes.max_tex, planes.sum_tex / planes.samples, planes.max_depth, planes.samples,
+                    size_passed ? "ok" : "FAILED");
+    }
+
+    return passed ? 0 : 1;
+}